@@ -2,9 +2,23 @@
  * Created by Ivo Georgiev on 2/9/16.
  */
 
+#if defined(MEM_POOL_THREADS) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for sched_getcpu()
+#endif
+
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <stdio.h> // for perror()
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h> // for the size class scans
+#endif
+#include <unistd.h> // for sysconf()
+#ifdef MEM_POOL_THREADS
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h> // for uintptr_t
+#endif
 
 #include "mem_pool.h"
 
@@ -14,20 +28,102 @@
 /*           */
 /*************/
 static const float      MEM_FILL_FACTOR                 = 0.75;
-static const unsigned   MEM_EXPAND_FACTOR               = 2;
 
 static const unsigned   MEM_POOL_STORE_INIT_CAPACITY    = 20;
 static const float      MEM_POOL_STORE_FILL_FACTOR      = 0.75;
 static const unsigned   MEM_POOL_STORE_EXPAND_FACTOR    = 2;
 
-static const unsigned   MEM_NODE_HEAP_INIT_CAPACITY     = 40;
+// the node heap grows a chunk at a time; the rest size its chunk directory
+static const unsigned   MEM_NODE_HEAP_CHUNK_NODES       = 256;
+static const unsigned   MEM_NODE_HEAP_INIT_CHUNKS       = 4;
 static const float      MEM_NODE_HEAP_FILL_FACTOR       = 0.75;
 static const unsigned   MEM_NODE_HEAP_EXPAND_FACTOR     = 2;
 
+// nodes link to each other by 31-bit index into the node heap; node 0 is
+// the nil sentinel and node 1 the head of the list, the first one taken
+static const unsigned   MEM_NODE_HEAP_MAX_NODES         = 1U << 31;
+static const unsigned   MEM_NODE_HEAD                   = 1;
+
 static const unsigned   MEM_GAP_IX_INIT_CAPACITY        = 40;
 static const float      MEM_GAP_IX_FILL_FACTOR          = 0.75;
 static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 
+// the allocation map is open-addressed, so its capacity is a power of two
+static const unsigned   MEM_ALLOC_MAP_INIT_CAPACITY     = 64;
+static const float      MEM_ALLOC_MAP_FILL_FACTOR       = 0.5;
+static const unsigned   MEM_ALLOC_MAP_EXPAND_FACTOR     = 2;
+
+// SEGREGATED_FIT size classes: class k holds gaps of [2^k, 2^(k+1)) bytes
+#define MEM_SEG_LIST_CLASSES (8 * sizeof(size_t))
+
+static const unsigned   MEM_SEG_CLASS_INIT_CAPACITY     = 16;
+static const unsigned   MEM_SEG_CLASS_EXPAND_FACTOR     = 2;
+
+// TLSF_FIT classes: first level by most significant bit, second level
+// splits each power-of-two range into 2^MEM_TLSF_SL_LOG2 equal parts
+#define MEM_TLSF_SL_LOG2     4
+#define MEM_TLSF_SL_COUNT    (1 << MEM_TLSF_SL_LOG2)
+#define MEM_TLSF_FL_COUNT    (8 * sizeof(size_t) - MEM_TLSF_SL_LOG2 + 1)
+
+// BUDDY_FIT block orders: a block of order k is 2^k bytes at a 2^k offset
+#define MEM_BUDDY_ORDERS     (8 * sizeof(size_t))
+
+// TAGGED_FIT segments start and end on word boundaries, and are big
+// enough to hold the tags and list links of a gap
+#define MEM_TAG_ALIGN        sizeof(size_t)
+#define MEM_TAG_MIN_EXTENT   (sizeof(gap_tag_t) + sizeof(size_t))
+
+// BITMAP_FIT pools are carved in granules of one alloc_t, which is also
+// the in-band record at the start of every allocation
+#define MEM_BITMAP_GRANULE   sizeof(alloc_t)
+
+// contexts, and the remote free queue of a pool, are kept off the cache
+// lines that other threads write
+#define MEM_CACHE_LINE       64
+
+// define MEM_POOL_STATS to count the nodes visited by the gap searches
+#ifdef MEM_POOL_STATS
+#define MEM_STAT(stmt) stmt
+#else
+#define MEM_STAT(stmt)
+#endif
+
+// define MEM_POOL_THREADS to lock the pool store and each pool, so that
+// threads can allocate in different pools in parallel
+#ifdef MEM_POOL_THREADS
+#define MEM_LOCK(lock)   pthread_mutex_lock(lock)
+#define MEM_UNLOCK(lock) pthread_mutex_unlock(lock)
+#else
+#define MEM_LOCK(lock)
+#define MEM_UNLOCK(lock)
+#endif
+
+#ifdef MEM_POOL_THREADS
+// per-thread caches: in a pool with them on, a request of up to
+// MEM_TCACHE_MAX_SIZE bytes is rounded up to a class of MEM_TCACHE_GRANULE
+// bytes, and each thread keeps a stack of free blocks of every class
+#define MEM_TCACHE_GRANULE   16
+#define MEM_TCACHE_CLASSES   16
+#define MEM_TCACHE_MAX_SIZE  (MEM_TCACHE_GRANULE * MEM_TCACHE_CLASSES)
+#define MEM_TCACHE_DEPTH     32 // blocks cached per class
+#define MEM_TCACHE_POOLS     4  // pools cached per thread
+
+// an allocated node has no use for its gap fields, so gap_slot tells a
+// block out with the user from one in a thread's cache or on its pool's
+// remote free queue; no gap has any of these
+#define MEM_NODE_LIVE        0xFFFFFFFFU
+#define MEM_NODE_CACHED      0xFFFFFFFEU
+#define MEM_NODE_QUEUED      0xFFFFFFFDU
+
+// a node chunk is aligned to its size (a power of two, of 32-byte nodes),
+// so that a record's chunk is its address rounded down
+#define MEM_NODE_CHUNK_BYTES (MEM_NODE_HEAP_CHUNK_NODES * sizeof(node_t))
+
+static const unsigned   MEM_TCACHE_BATCH                = 16; // blocks taken from or given back to the pool at once
+static const unsigned   MEM_CHUNK_SET_INIT_CAPACITY     = 16;
+static const unsigned   MEM_CHUNK_SET_EXPAND_FACTOR     = 2;
+#endif
+
 
 
 /*********************/
@@ -35,27 +131,167 @@ static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 /* Type declarations */
 /*                   */
 /*********************/
+// 32 bytes: the flags take the top bits of the links, and a gap is in a
+// size class or in the gap index tree, never both
 typedef struct _node {
     alloc_t alloc_record;
-    unsigned used;
-    unsigned allocated;
-    struct _node *next, *prev; // doubly-linked list for gap deletion
+    unsigned next : 31, used : 1; // doubly-linked list for gap deletion
+    unsigned prev : 31, allocated : 1;
+    union {
+        struct {
+            unsigned gap_next, gap_prev; // size-class free list (TLSF_FIT, BUDDY_FIT)
+        };
+        // this gap's position in its size class (SEGREGATED_FIT), or its
+        // slot in the gap index tree, 0 if none (the other policies)
+        unsigned gap_slot;
+    };
 } node_t, *node_pt;
 
+// the gap index is an AVL tree keyed on (size, address), or on address
+// alone for FIRST_FIT, stored in the gap_ix array and linked by slot
+// number; slot 0 is the nil sentinel
 typedef struct _gap {
     size_t size;
-    node_pt node;
+    const char *mem; // the gap's address, the key besides its size
+    unsigned node;
+    unsigned left, right; // child slots, 0 for none (free slots chain on right)
+    unsigned parent; // parent slot, 0 for the root
+    unsigned height;
+    size_t max_size; // largest gap in the subtree rooted here
 } gap_t, *gap_pt;
 
+// a TAGGED_FIT segment starts with a header and ends with a footer inside
+// pool.mem, both holding its extent: the bytes it spans, tags included,
+// with the low bit set iff it is allocated
+typedef struct _tag {
+    alloc_t alloc_record; // handed out as the allocation
+    size_t extent;
+} tag_t, *tag_pt;
+
+// a TAGGED_FIT gap is chained into its size class list through its payload
+typedef struct _gap_tag {
+    tag_t tag;
+    struct _gap_tag *gap_next, *gap_prev;
+} gap_tag_t, *gap_tag_pt;
+
+// a context's pools; the alignment keeps each context on cache lines of
+// its own
+struct _mem_ctx {
+    _Alignas(MEM_CACHE_LINE) struct _pool_mgr **pool_store; // an array of pointers, only expand
+    unsigned pool_store_size; // slots ever used; closed pools leave NULL
+    unsigned pool_store_capacity;
+    unsigned *pool_store_free; // stack of the NULL slots below pool_store_size
+    unsigned pool_store_num_free;
+#ifdef MEM_POOL_THREADS
+    pthread_mutex_t pool_store_lock;
+#endif
+};
+
 typedef struct _pool_mgr {
     pool_t pool;
-    node_pt node_heap;
+    mem_ctx_pt ctx; // the context whose store holds the pool
+    unsigned store_slot; // this pool's entry in the store
+    node_pt *node_heap; // directory of chunks of MEM_NODE_HEAP_CHUNK_NODES nodes, which never move
+    unsigned node_heap_chunks;
+    unsigned node_heap_capacity; // entries in the directory
     unsigned total_nodes;
     unsigned used_nodes;
+    unsigned node_free; // head of the list of unused nodes, chained on next
     gap_pt gap_ix;
     unsigned gap_ix_capacity;
+    unsigned gap_ix_root;
+    unsigned gap_ix_max; // slot of the largest gap (the tail of the (size, address) order), 0 if none
+    unsigned gap_ix_free; // head of the list of unused gap_ix slots
+    // the node of every allocation, hashed on its offset in the pool and
+    // linearly probed; 0 marks an empty entry
+    unsigned *alloc_map;
+    unsigned alloc_map_capacity;
+    // SEGREGATED_FIT classes as parallel arrays of gap sizes and nodes, so
+    // that a search scans sizes without touching the nodes
+    size_t *seg_sizes[MEM_SEG_LIST_CLASSES];
+    unsigned *seg_nodes[MEM_SEG_LIST_CLASSES];
+    unsigned seg_counts[MEM_SEG_LIST_CLASSES];
+    unsigned seg_capacities[MEM_SEG_LIST_CLASSES];
+    unsigned long long seg_map; // bit k set iff seg_counts[k] != 0
+    unsigned tlsf_lists[MEM_TLSF_FL_COUNT][MEM_TLSF_SL_COUNT];
+    unsigned long long tlsf_fl_map; // bit fl set iff tlsf_sl_map[fl] != 0
+    unsigned tlsf_sl_map[MEM_TLSF_FL_COUNT]; // bit sl set iff tlsf_lists[fl][sl] is non-empty
+    unsigned buddy_lists[MEM_BUDDY_ORDERS];
+    unsigned long long buddy_map; // bit k set iff buddy_lists[k] is non-empty
+    unsigned buddy_counts[MEM_BUDDY_ORDERS]; // free blocks of each order
+    unsigned rover; // NEXT_FIT: where the next search starts, 0 for the head
+    // SLAB_FIT pools have no node heap or gap index, only these
+    alloc_pt slab_records; // one per object, handed out as the allocation
+    unsigned long long *slab_map; // bit i set iff object i is allocated
+    size_t slab_obj_size, slab_stride, slab_count;
+    size_t slab_free; // first free object, slab_count if none; each free object holds the next
+    // LOCKFREE_SLAB_FIT pools keep the free list out of the objects: the
+    // head is an index in the low half and a generation in the high half,
+    // so that a compare-and-swap fails on a head popped and pushed again
+    unsigned *slab_next;
+    unsigned long long slab_head;
+    // TAGGED_FIT pools keep all other metadata in pool.mem, see tag_t
+    gap_tag_pt tag_lists[MEM_SEG_LIST_CLASSES]; // gaps by size class of their extent
+    unsigned long long tag_map; // bit k set iff tag_lists[k] is non-empty
+    // BITMAP_FIT pools mark each granule in two bitmaps, so an allocation
+    // is a run of used granules of which only the first is a start
+    unsigned long long *bitmap_used; // bit i set iff granule i is allocated
+    unsigned long long *bitmap_starts; // bit i set iff an allocation starts at granule i
+    size_t bitmap_granules;
+    size_t bitmap_rover; // where the next search starts, as rover does for NEXT_FIT
+#ifdef MEM_POOL_STATS
+    unsigned long search_steps;
+#endif
+#ifdef MEM_POOL_THREADS
+    pthread_mutex_t lock; // held by the calls that read or change the pool
+    unsigned tcache; // nonzero if the per-thread caches are on
+    unsigned long tcache_hits, tcache_misses; // as added up by the threads on refill and flush
+    // with an owner, other threads' frees are pushed onto a lock-free
+    // stack, linked through the freed memory, and freed under the lock
+    // by the next allocation
+    pthread_t owner;
+    unsigned owned; // nonzero once the pool has an owner, which never changes
+    char remote_pad[MEM_CACHE_LINE];
+    alloc_pt remote_frees;
+    struct _chunk_set *chunk_set; // the node chunks, for _mem_owns_node
+#endif
 } pool_mgr_t, *pool_mgr_pt;
 
+#ifdef MEM_POOL_THREADS
+// a pool's node chunks by address, linearly probed, read without the
+// pool's lock; an outgrown set is kept until the pool closes, since a
+// reader may still be probing it
+typedef struct _chunk_set {
+    struct _chunk_set *outgrown;
+    unsigned capacity; // a power of two
+    node_pt chunks[]; // NULL for an empty entry
+} chunk_set_t, *chunk_set_pt;
+#endif
+
+// the shards of a sharded pool, by address of their memory, so that a
+// free finds its shard by binary search
+typedef struct _sharded_pool_mgr {
+    sharded_pool_t pool;
+    pool_pt *by_address;
+} sharded_pool_mgr_t, *sharded_pool_mgr_pt;
+
+#ifdef MEM_POOL_THREADS
+// a thread's cached blocks of one pool; the blocks are still allocated in
+// the pool, so a stack holds them without touching it
+typedef struct _tcache {
+    pool_mgr_pt pool_mgr; // NULL if the entry is unused
+    unsigned long hits, misses; // not yet added to the pool's counters
+    unsigned counts[MEM_TCACHE_CLASSES];
+    alloc_pt blocks[MEM_TCACHE_CLASSES][MEM_TCACHE_DEPTH];
+} tcache_t, *tcache_pt;
+
+// a thread's entries, on the list of every thread's that a close walks
+typedef struct _tcache_set {
+    tcache_t entries[MEM_TCACHE_POOLS];
+    struct _tcache_set *next, *prev;
+} tcache_set_t, *tcache_set_pt;
+#endif
+
 
 
 /***************************/
@@ -63,9 +299,21 @@ typedef struct _pool_mgr {
 /* Static global variables */
 /*                         */
 /***************************/
-static pool_mgr_pt *pool_store = NULL; // an array of pointers, only expand
-static unsigned pool_store_size = 0;
-static unsigned pool_store_capacity = 0;
+// the context of mem_init, mem_pool_open and the others without a context
+static mem_ctx_t default_ctx = {
+        .pool_store = NULL,
+#ifdef MEM_POOL_THREADS
+        .pool_store_lock = PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+#ifdef MEM_POOL_THREADS
+static pthread_key_t tcache_key; // each thread's MEM_TCACHE_POOLS entries, flushed on exit
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+// every thread's entries; a flush holds the lock, so that a close cannot
+// free the pool meanwhile
+static tcache_set_pt tcache_sets = NULL;
+static pthread_mutex_t tcache_sets_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 
 
@@ -74,18 +322,79 @@ static unsigned pool_store_capacity = 0;
 /* Forward declarations of static functions */
 /*                                          */
 /********************************************/
-static alloc_status _mem_resize_pool_store();
-static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_new_alloc(pool_pt pool, size_t size);
+static alloc_status _mem_del_alloc(pool_pt pool, alloc_pt alloc);
+static alloc_status _mem_del_alloc_addr(pool_pt pool, char *mem);
+static void _mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
+static int _mem_pool_closable(pool_mgr_pt pool_mgr);
+static int _mem_has_nodes(alloc_policy policy);
+static alloc_status _mem_ctx_init(mem_ctx_pt ctx);
+static alloc_status _mem_ctx_free(mem_ctx_pt ctx);
+static alloc_status _mem_resize_pool_store(mem_ctx_pt ctx);
+static alloc_status _mem_add_to_pool_store(mem_ctx_pt ctx, pool_mgr_pt pool_mgr);
+static void _mem_remove_from_pool_store(pool_mgr_pt pool_mgr);
+static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr, unsigned extra_nodes);
+static alloc_status _mem_add_node_chunk(pool_mgr_pt pool_mgr);
+static void _mem_free_node_heap(pool_mgr_pt pool_mgr);
+static node_pt _mem_node(pool_mgr_pt pool_mgr, unsigned ix);
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr);
+static alloc_status _mem_resize_alloc_map(pool_mgr_pt pool_mgr);
+static void _mem_alloc_map_insert(pool_mgr_pt pool_mgr, unsigned ix);
+static unsigned _mem_alloc_map_remove(pool_mgr_pt pool_mgr, node_pt node);
+static node_pt _mem_alloc_map_find(pool_mgr_pt pool_mgr, const char *mem);
+static alloc_status _mem_reserve_gap_ix(pool_mgr_pt pool_mgr, size_t size);
 static alloc_status
         _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
                            size_t size,
-                           node_pt node);
+                           unsigned ix);
 static alloc_status
         _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
                                 size_t size,
-                                node_pt node);
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
+                                unsigned ix);
+static unsigned _mem_find_first_gap(pool_mgr_pt pool_mgr, size_t size);
+static unsigned _mem_find_best_gap(pool_mgr_pt pool_mgr, size_t size);
+static unsigned _mem_find_seg_gap(pool_mgr_pt pool_mgr, size_t size);
+static unsigned _mem_find_tlsf_gap(pool_mgr_pt pool_mgr, size_t size);
+static unsigned _mem_find_next_gap(pool_mgr_pt pool_mgr, size_t size);
+static unsigned _mem_find_worst_gap(pool_mgr_pt pool_mgr, size_t size);
+static void _mem_release_node(pool_mgr_pt pool_mgr, unsigned ix);
+static unsigned _mem_acquire_node(pool_mgr_pt pool_mgr);
+static alloc_status _mem_buddy_init(pool_mgr_pt pool_mgr);
+static unsigned _mem_buddy_alloc(pool_mgr_pt pool_mgr, size_t size);
+static void _mem_buddy_free(pool_mgr_pt pool_mgr, unsigned ix);
+static size_t _mem_buddy_extent(pool_mgr_pt pool_mgr, node_pt node);
+static alloc_pt _mem_slab_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_slab_free(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void _mem_slab_inspect(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments);
+static pool_pt _mem_slab_pool_open(mem_ctx_pt ctx, size_t obj_size, size_t count, alloc_policy policy);
+static alloc_pt _mem_lockfree_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_lockfree_free(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void _mem_lockfree_inspect(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments);
+static pool_pt _mem_tag_pool_open(mem_ctx_pt ctx, size_t size);
+static alloc_pt _mem_tag_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_tag_free(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void _mem_tag_inspect(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments);
+static pool_pt _mem_bitmap_pool_open(mem_ctx_pt ctx, size_t size);
+static alloc_pt _mem_bitmap_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_bitmap_free(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void _mem_bitmap_inspect(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments);
+static unsigned _mem_shard_index(unsigned num_shards);
+static pool_pt _mem_shard_of(sharded_pool_mgr_pt sharded_mgr, const char *mem);
+#ifdef MEM_POOL_THREADS
+static void _mem_tcache_make_key();
+static void _mem_tcache_destroy(void *tcache_set);
+static tcache_pt _mem_tcache_find(pool_mgr_pt pool_mgr, int create);
+static void _mem_tcache_flush(tcache_pt tcache);
+static void _mem_tcache_unbind(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_tcache_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_tcache_free(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static alloc_status _mem_tcache_release(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static alloc_status _mem_remote_push(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void _mem_remote_drain(pool_mgr_pt pool_mgr);
+static unsigned _mem_chunk_set_home(chunk_set_pt set, node_pt chunk);
+static alloc_status _mem_chunk_set_add(pool_mgr_pt pool_mgr, node_pt chunk);
+static int _mem_owns_node(pool_mgr_pt pool_mgr, alloc_pt alloc);
+#endif
 
 
 
@@ -95,91 +404,134 @@ static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
 /*                                      */
 /****************************************/
 alloc_status mem_init() {
-    // ensure that it's called only once until mem_free
-    // allocate the pool store with initial capacity
-    // note: holds pointers only, other functions to allocate/deallocate
-    if(pool_store != NULL){
-        return ALLOC_CALLED_AGAIN; //could this report incorrect status for dealloc errors
-    }
-    pool_store = (pool_mgr_pt *)calloc(MEM_POOL_STORE_INIT_CAPACITY, sizeof(pool_mgr_pt));
-    if(pool_store == NULL){
-        return ALLOC_FAIL;
-    }
-    pool_store_size = 0;
-    pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
-    return ALLOC_OK;
+    return _mem_ctx_init(&default_ctx);
 }
 
+// note: with MEM_POOL_THREADS, no other thread may still be using a pool
 alloc_status mem_free() {
+    return _mem_ctx_free(&default_ctx);
+}
 
-    if(!pool_store){
-        return ALLOC_CALLED_AGAIN;
+mem_ctx_pt mem_ctx_create() {
+    mem_ctx_pt ctx = aligned_alloc(MEM_CACHE_LINE, sizeof(mem_ctx_t));
+    if(ctx == NULL){
+        return NULL;
     }
-        for (int i = 0; i < pool_store_size; i++) {
-            if(pool_store[i] != NULL){
-//                if(mem_pool_close((pool_pt)(pool_store[i])) != ALLOC_OK){
-//                    return ALLOC_FAIL;
-//                }
-                mem_pool_close((pool_pt) pool_store[i]);
-            }
-        }
-        free(pool_store);
-        pool_store_size = 0;
-        pool_store_capacity = 0;
-        pool_store = NULL;
-        return ALLOC_OK;
+    memset(ctx, 0, sizeof(mem_ctx_t));
+#ifdef MEM_POOL_THREADS
+    if(pthread_mutex_init(&ctx->pool_store_lock, NULL) != 0){
+        free(ctx);
+        return NULL;
+    }
+#endif
+    if(_mem_ctx_init(ctx) != ALLOC_OK){
+        mem_ctx_destroy(ctx);
+        return NULL;
+    }
+    return ctx;
+}
 
+// note: as with mem_free, pools that still hold allocations are not closed;
+// they are detached and can still be closed once empty
+alloc_status mem_ctx_destroy(mem_ctx_pt ctx) {
+    if(ctx == NULL){
+        return ALLOC_NOT_FREED;
+    }
+    if(ctx->pool_store != NULL){
+        _mem_ctx_free(ctx);
+    }
+#ifdef MEM_POOL_THREADS
+    pthread_mutex_destroy(&ctx->pool_store_lock);
+#endif
+    free(ctx);
+    return ALLOC_OK;
 }
 
 pool_pt mem_pool_open(size_t size, alloc_policy policy) {
-    if(pool_store != NULL){
-        if(_mem_resize_pool_store() == ALLOC_OK){
-            pool_mgr_pt  new_mem_pool_manager = malloc(sizeof(pool_mgr_t));
-            if(new_mem_pool_manager != NULL){
-                new_mem_pool_manager->pool.mem = malloc(size);
-                if(NULL != new_mem_pool_manager->pool.mem){
-                    new_mem_pool_manager->node_heap = calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(node_t));
-                    if(NULL != new_mem_pool_manager->node_heap) {
-                        new_mem_pool_manager->gap_ix = calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
-                        if(NULL != new_mem_pool_manager->gap_ix){
-
-                            new_mem_pool_manager->node_heap[0].used = 1;
-                            new_mem_pool_manager->node_heap[0].allocated = 0;
-                            new_mem_pool_manager->node_heap[0].alloc_record.size = size;
-                            new_mem_pool_manager->node_heap[0].alloc_record.mem = new_mem_pool_manager->pool.mem;
-                            new_mem_pool_manager->pool.alloc_size = 0;
-                            new_mem_pool_manager->pool.total_size = size;
-                            new_mem_pool_manager->pool.policy = policy;
-                            new_mem_pool_manager->pool.num_gaps = 0;
-                            new_mem_pool_manager->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
-                            new_mem_pool_manager->used_nodes = 1;
-                            new_mem_pool_manager->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
-                            pool_store[pool_store_size] = new_mem_pool_manager;
-                            pool_store_size ++;
-                            _mem_add_to_gap_ix(new_mem_pool_manager, size, &new_mem_pool_manager->node_heap[0]);
-
-                            return (pool_pt)new_mem_pool_manager;
-
-                        }else{
-                            free(new_mem_pool_manager->node_heap);
+    return mem_ctx_pool_open(&default_ctx, size, policy);
+}
+
+pool_pt mem_ctx_pool_open(mem_ctx_pt ctx, size_t size, alloc_policy policy) {
+    if(policy == SLAB_FIT || policy == LOCKFREE_SLAB_FIT){
+        return NULL; // needs an object size, see mem_pool_open_slab
+    }
+    if(policy == TAGGED_FIT){
+        return _mem_tag_pool_open(ctx, size);
+    }
+    if(policy == BITMAP_FIT){
+        return _mem_bitmap_pool_open(ctx, size);
+    }
+    if(ctx->pool_store != NULL){
+        pool_mgr_pt  new_mem_pool_manager = calloc(1, sizeof(pool_mgr_t)); // empty size-class lists
+        if(new_mem_pool_manager != NULL){
+            new_mem_pool_manager->pool.mem = malloc(size);
+            if(NULL != new_mem_pool_manager->pool.mem){
+                if(_mem_add_node_chunk(new_mem_pool_manager) == ALLOC_OK) {
+                    new_mem_pool_manager->gap_ix = calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
+                    if(NULL != new_mem_pool_manager->gap_ix){
+
+                        // the first node taken is the head of the list
+                        node_pt head = _mem_node(new_mem_pool_manager, _mem_acquire_node(new_mem_pool_manager));
+                        head->alloc_record.size = size;
+                        head->alloc_record.mem = new_mem_pool_manager->pool.mem;
+                        new_mem_pool_manager->pool.alloc_size = 0;
+                        new_mem_pool_manager->pool.total_size = size;
+                        new_mem_pool_manager->pool.policy = policy;
+                        new_mem_pool_manager->pool.num_allocs = 0;
+                        new_mem_pool_manager->pool.num_gaps = 0;
+                        new_mem_pool_manager->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+                        new_mem_pool_manager->gap_ix_root = 0;
+                        new_mem_pool_manager->gap_ix_max = 0;
+                        new_mem_pool_manager->gap_ix_free = 0;
+                        for (unsigned u = MEM_GAP_IX_INIT_CAPACITY - 1; u > 0; u--) {
+                            new_mem_pool_manager->gap_ix[u].right = new_mem_pool_manager->gap_ix_free;
+                            new_mem_pool_manager->gap_ix_free = u;
+                        }
+                        if(_mem_add_to_pool_store(ctx, new_mem_pool_manager) != ALLOC_OK){
+                            _mem_free_node_heap(new_mem_pool_manager);
+                            free(new_mem_pool_manager->gap_ix);
+                            free(new_mem_pool_manager->pool.mem);
+                            free(new_mem_pool_manager);
+                            return NULL;
+                        }
+                        alloc_status status;
+                        if (policy == BUDDY_FIT) {
+                            status = _mem_buddy_init(new_mem_pool_manager);
+                        } else {
+                            status = _mem_add_to_gap_ix(new_mem_pool_manager, size, MEM_NODE_HEAD);
+                        }
+                        if(status != ALLOC_OK){
+                            _mem_remove_from_pool_store(new_mem_pool_manager);
+                            _mem_free_node_heap(new_mem_pool_manager);
+                            free(new_mem_pool_manager->gap_ix);
+                            for (unsigned k = 0; k < MEM_SEG_LIST_CLASSES; k++) {
+                                free(new_mem_pool_manager->seg_sizes[k]);
+                                free(new_mem_pool_manager->seg_nodes[k]);
+                            }
                             free(new_mem_pool_manager->pool.mem);
                             free(new_mem_pool_manager);
                             return NULL;
                         }
+
+                        return (pool_pt)new_mem_pool_manager;
+
                     }else{
+                        _mem_free_node_heap(new_mem_pool_manager);
                         free(new_mem_pool_manager->pool.mem);
                         free(new_mem_pool_manager);
                         return NULL;
                     }
                 }else{
-                    //Allocating pool failed free manager
+                    _mem_free_node_heap(new_mem_pool_manager);
+                    free(new_mem_pool_manager->pool.mem);
                     free(new_mem_pool_manager);
                     return NULL;
                 }
             }else{
+                //Allocating pool failed free manager
+                free(new_mem_pool_manager);
                 return NULL;
             }
-
         }else{
             return NULL;
         }
@@ -208,21 +560,50 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
     return NULL;
 }
 
+pool_pt mem_pool_open_slab(size_t obj_size, size_t count) {
+    return _mem_slab_pool_open(&default_ctx, obj_size, count, SLAB_FIT);
+}
+
+pool_pt mem_ctx_pool_open_slab(mem_ctx_pt ctx, size_t obj_size, size_t count) {
+    return _mem_slab_pool_open(ctx, obj_size, count, SLAB_FIT);
+}
+
+pool_pt mem_pool_open_lockfree(size_t obj_size, size_t count) {
+    return _mem_slab_pool_open(&default_ctx, obj_size, count, LOCKFREE_SLAB_FIT);
+}
+
+pool_pt mem_ctx_pool_open_lockfree(mem_ctx_pt ctx, size_t obj_size, size_t count) {
+    return _mem_slab_pool_open(ctx, obj_size, count, LOCKFREE_SLAB_FIT);
+}
+
 alloc_status mem_pool_close(pool_pt pool) {
     pool_mgr_pt local_pool_mgr_pt = (pool_mgr_pt)pool;
 
     if(NULL == pool){
         return ALLOC_NOT_FREED;
     }
-    if(pool->num_gaps == 1 && pool->num_allocs == 0){
-        free(local_pool_mgr_pt->node_heap);
+    if(_mem_pool_closable(local_pool_mgr_pt)){
+#ifdef MEM_POOL_THREADS
+        if(local_pool_mgr_pt->tcache){
+            _mem_tcache_unbind(local_pool_mgr_pt);
+        }
+#endif
+        _mem_free_node_heap(local_pool_mgr_pt);
         free(local_pool_mgr_pt->pool.mem);
         free(local_pool_mgr_pt->gap_ix);
-        for (int i = 0; i < pool_store_size; i++) {
-            if (pool_store[i] == local_pool_mgr_pt) {
-                pool_store[i] = NULL;
+        free(local_pool_mgr_pt->slab_records);
+        free(local_pool_mgr_pt->slab_map);
+        free(local_pool_mgr_pt->slab_next);
+        free(local_pool_mgr_pt->alloc_map);
+        free(local_pool_mgr_pt->bitmap_used);
+        free(local_pool_mgr_pt->bitmap_starts);
+        if (pool->policy == SEGREGATED_FIT) {
+            for (unsigned k = 0; k < MEM_SEG_LIST_CLASSES; k++) {
+                free(local_pool_mgr_pt->seg_sizes[k]);
+                free(local_pool_mgr_pt->seg_nodes[k]);
             }
         }
+        _mem_remove_from_pool_store(local_pool_mgr_pt); // the slot goes on the free list, for the next pool opened
         free(local_pool_mgr_pt);
         return ALLOC_OK;
     }else{
@@ -245,153 +626,507 @@ alloc_status mem_pool_close(pool_pt pool) {
 
 
 alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
+    // LOCKFREE_SLAB_FIT pools never take the lock
+    if(pool->policy == LOCKFREE_SLAB_FIT){
+        return _mem_lockfree_alloc((pool_mgr_pt) pool, size);
+    }
+#ifdef MEM_POOL_THREADS
+    if(__atomic_load_n(&((pool_mgr_pt) pool)->tcache, __ATOMIC_ACQUIRE) && size != 0 && size <= MEM_TCACHE_MAX_SIZE){
+        return _mem_tcache_alloc((pool_mgr_pt) pool, size);
+    }
+#endif
+    MEM_LOCK(&((pool_mgr_pt) pool)->lock);
+    alloc_pt alloc = _mem_new_alloc(pool, size);
+    MEM_UNLOCK(&((pool_mgr_pt) pool)->lock);
+    return alloc;
+}
+
+alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
+    if(pool->policy == LOCKFREE_SLAB_FIT){
+        return _mem_lockfree_free((pool_mgr_pt) pool, alloc);
+    }
+#ifdef MEM_POOL_THREADS
+    // the link needs room in the allocation; as below, a record that is
+    // not one of the pool's nodes is turned down under the lock
+    if(__atomic_load_n(&((pool_mgr_pt) pool)->owned, __ATOMIC_ACQUIRE) && alloc != NULL && alloc->size >= sizeof(alloc_pt)
+       && !pthread_equal(pthread_self(), ((pool_mgr_pt) pool)->owner)
+       && _mem_owns_node((pool_mgr_pt) pool, alloc)){
+        return _mem_remote_push((pool_mgr_pt) pool, alloc);
+    }
+    // only blocks of a class size can be handed out again; a record that
+    // is not one of the pool's nodes is turned down under the lock
+    if(__atomic_load_n(&((pool_mgr_pt) pool)->tcache, __ATOMIC_ACQUIRE) && alloc != NULL && alloc->size != 0
+       && alloc->size <= MEM_TCACHE_MAX_SIZE && alloc->size % MEM_TCACHE_GRANULE == 0
+       && _mem_owns_node((pool_mgr_pt) pool, alloc)){
+        return _mem_tcache_free((pool_mgr_pt) pool, alloc);
+    }
+#endif
+    MEM_LOCK(&((pool_mgr_pt) pool)->lock);
+    alloc_status status = _mem_del_alloc(pool, alloc);
+    MEM_UNLOCK(&((pool_mgr_pt) pool)->lock);
+    return status;
+}
+
+char *mem_new_alloc_addr(pool_pt pool, size_t size) {
+    // a zero-size allocation would share its address with the next segment
+    if(size == 0){
+        return NULL;
+    }
+    alloc_pt alloc = mem_new_alloc(pool, size);
+    return (alloc != NULL) ? alloc->mem : NULL;
+}
+
+alloc_status mem_del_alloc_addr(pool_pt pool, char *mem) {
+    if(pool->policy == LOCKFREE_SLAB_FIT){
+        return _mem_del_alloc_addr(pool, mem);
+    }
+    MEM_LOCK(&((pool_mgr_pt) pool)->lock);
+    alloc_status status = _mem_del_alloc_addr(pool, mem);
+    MEM_UNLOCK(&((pool_mgr_pt) pool)->lock);
+    return status;
+}
+
+void mem_inspect_pool(pool_pt pool,
+                      pool_segment_pt *segments,
+                      unsigned *num_segments) {
+    MEM_LOCK(&((pool_mgr_pt) pool)->lock);
+#ifdef MEM_POOL_THREADS
+    _mem_remote_drain((pool_mgr_pt) pool);
+#endif
+    _mem_inspect_pool(pool, segments, num_segments);
+    MEM_UNLOCK(&((pool_mgr_pt) pool)->lock);
+}
+
+void mem_inspect_buddy(pool_pt pool,
+                       unsigned **free_blocks,
+                       unsigned *num_orders) {
+    pool_mgr_pt  local_pool_mgr = (pool_mgr_pt) pool;
+    *free_blocks = NULL;
+    *num_orders = 0;
+    if(local_pool_mgr->pool.policy != BUDDY_FIT || local_pool_mgr->pool.total_size == 0){
+        return;
+    }
+    // orders above that of the pool size can never hold a block
+    unsigned orders = (unsigned) (8 * sizeof(unsigned long long) - __builtin_clzll(local_pool_mgr->pool.total_size));
+    unsigned *counts = calloc(orders, sizeof(unsigned));
+    if(counts == NULL){
+        return;
+    }
+    MEM_LOCK(&local_pool_mgr->lock);
+    for(unsigned k = 0; k < orders; k++){
+        counts[k] = local_pool_mgr->buddy_counts[k];
+    }
+    MEM_UNLOCK(&local_pool_mgr->lock);
+    *free_blocks = counts;
+    *num_orders = orders;
+}
+
+alloc_status mem_pool_set_owner(pool_pt pool) {
+    // queued blocks are marked in their nodes, as cached ones are
+    if(!_mem_has_nodes(pool->policy)){
+        return ALLOC_FAIL;
+    }
+#ifdef MEM_POOL_THREADS
+    // owner is written once, before owned is published, so that the
+    // frees which read owned without the lock see the owner too
+    pool_mgr_pt  local_pool_mgr = (pool_mgr_pt) pool;
+    MEM_LOCK(&local_pool_mgr->lock);
+    if(local_pool_mgr->owned){
+        MEM_UNLOCK(&local_pool_mgr->lock);
+        return ALLOC_CALLED_AGAIN;
+    }
+    local_pool_mgr->owner = pthread_self();
+    __atomic_store_n(&local_pool_mgr->owned, 1, __ATOMIC_RELEASE);
+    MEM_UNLOCK(&local_pool_mgr->lock);
+    return ALLOC_OK;
+#else
+    return ALLOC_FAIL;
+#endif
+}
+
+alloc_status mem_pool_enable_tcache(pool_pt pool) {
+    // cached blocks are marked in their nodes, so only pools with a node
+    // heap can cache them; slab objects could not be rounded up anyway
+    if(!_mem_has_nodes(pool->policy)){
+        return ALLOC_FAIL;
+    }
+#ifdef MEM_POOL_THREADS
+    if(pthread_once(&tcache_key_once, _mem_tcache_make_key) != 0){
+        return ALLOC_FAIL;
+    }
+    // read without the lock by the allocations and frees
+    __atomic_store_n(&((pool_mgr_pt) pool)->tcache, 1, __ATOMIC_RELEASE);
+    return ALLOC_OK;
+#else
+    return ALLOC_FAIL;
+#endif
+}
+
+void mem_tcache_flush() {
+#ifdef MEM_POOL_THREADS
+    pthread_once(&tcache_key_once, _mem_tcache_make_key);
+    tcache_set_pt set = pthread_getspecific(tcache_key);
+    if(set == NULL){
+        return;
+    }
+    MEM_LOCK(&tcache_sets_lock);
+    for(unsigned u = 0; u < MEM_TCACHE_POOLS; u++){
+        _mem_tcache_flush(&set->entries[u]);
+    }
+    MEM_UNLOCK(&tcache_sets_lock);
+#endif
+}
+
+sharded_pool_pt mem_sharded_pool_open(size_t shard_size, alloc_policy policy, unsigned num_shards) {
+    return mem_ctx_sharded_pool_open(&default_ctx, shard_size, policy, num_shards);
+}
+
+sharded_pool_pt mem_ctx_sharded_pool_open(mem_ctx_pt ctx, size_t shard_size, alloc_policy policy, unsigned num_shards) {
+    if(num_shards == 0){
+        long cpus = sysconf(_SC_NPROCESSORS_CONF);
+        num_shards = (cpus > 0) ? (unsigned) cpus : 1;
+    }
+    sharded_pool_mgr_pt sharded_mgr = calloc(1, sizeof(sharded_pool_mgr_t));
+    if(sharded_mgr == NULL){
+        return NULL;
+    }
+    sharded_mgr->pool.shards = calloc(num_shards, sizeof(pool_pt));
+    sharded_mgr->by_address = calloc(num_shards, sizeof(pool_pt));
+    if(sharded_mgr->pool.shards == NULL || sharded_mgr->by_address == NULL){
+        mem_sharded_pool_close((sharded_pool_pt) sharded_mgr);
+        return NULL;
+    }
+    for(unsigned u = 0; u < num_shards; u++){
+        pool_pt shard = mem_ctx_pool_open(ctx, shard_size, policy);
+        if(shard == NULL){
+            mem_sharded_pool_close((sharded_pool_pt) sharded_mgr);
+            return NULL;
+        }
+        sharded_mgr->pool.shards[u] = shard;
+        sharded_mgr->pool.num_shards++;
+        // insertion sort, once per open
+        unsigned v = u;
+        while(v > 0 && sharded_mgr->by_address[v - 1]->mem > shard->mem){
+            sharded_mgr->by_address[v] = sharded_mgr->by_address[v - 1];
+            v--;
+        }
+        sharded_mgr->by_address[v] = shard;
+    }
+    return (sharded_pool_pt) sharded_mgr;
+}
+
+// note: if any shard cannot close, all of them are left open, as
+// mem_pool_close leaves a pool
+alloc_status mem_sharded_pool_close(sharded_pool_pt pool) {
+    sharded_pool_mgr_pt sharded_mgr = (sharded_pool_mgr_pt) pool;
+    if(sharded_mgr == NULL){
+        return ALLOC_NOT_FREED;
+    }
+    for(unsigned u = 0; u < sharded_mgr->pool.num_shards; u++){
+        if(!_mem_pool_closable((pool_mgr_pt) sharded_mgr->pool.shards[u])){
+            return ALLOC_NOT_FREED;
+        }
+    }
+    for(unsigned u = 0; u < sharded_mgr->pool.num_shards; u++){
+        mem_pool_close(sharded_mgr->pool.shards[u]);
+    }
+    free(sharded_mgr->pool.shards);
+    free(sharded_mgr->by_address);
+    free(sharded_mgr);
+    return ALLOC_OK;
+}
+
+// the current CPU's shard first, then the others in turn
+alloc_pt mem_sharded_new_alloc(sharded_pool_pt pool, size_t size) {
+    // a zero-size allocation may sit at the end of its shard's memory
+    if(size == 0){
+        return NULL;
+    }
+    unsigned first = _mem_shard_index(pool->num_shards);
+    for(unsigned u = 0; u < pool->num_shards; u++){
+        alloc_pt alloc = mem_new_alloc(pool->shards[(first + u) % pool->num_shards], size);
+        if(alloc != NULL){
+            return alloc;
+        }
+    }
+    return NULL;
+}
+
+alloc_status mem_sharded_del_alloc(sharded_pool_pt pool, alloc_pt alloc) {
+    pool_pt shard = (alloc != NULL) ? _mem_shard_of((sharded_pool_mgr_pt) pool, alloc->mem) : NULL;
+    if(shard == NULL){
+        return ALLOC_NOT_FREED;
+    }
+    return mem_del_alloc(shard, alloc);
+}
+
+void mem_inspect_sharded_pool(sharded_pool_pt pool, pool_pt totals) {
+    memset(totals, 0, sizeof(pool_t));
+    for(unsigned u = 0; u < pool->num_shards; u++){
+        pool_pt shard = pool->shards[u];
+        MEM_LOCK(&((pool_mgr_pt) shard)->lock);
+        totals->policy = shard->policy;
+        totals->total_size += shard->total_size;
+        totals->alloc_size += shard->alloc_size;
+        totals->num_allocs += shard->num_allocs;
+        totals->num_gaps += shard->num_gaps;
+        MEM_UNLOCK(&((pool_mgr_pt) shard)->lock);
+    }
+}
+
+void mem_inspect_tcache(pool_pt pool,
+                        unsigned long *hits,
+                        unsigned long *misses) {
+    *hits = 0;
+    *misses = 0;
+#ifdef MEM_POOL_THREADS
+    pool_mgr_pt  local_pool_mgr = (pool_mgr_pt) pool;
+    MEM_LOCK(&local_pool_mgr->lock);
+    *hits = local_pool_mgr->tcache_hits;
+    *misses = local_pool_mgr->tcache_misses;
+    MEM_UNLOCK(&local_pool_mgr->lock);
+#else
+    (void) pool;
+#endif
+}
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+// the bodies of the user-facing calls on a pool, run with its lock held
+static alloc_pt _mem_new_alloc(pool_pt pool, size_t size) {
     pool_mgr_pt manager = (pool_mgr_pt) pool;
-    if(manager->gap_ix[0].node == NULL){
+#ifdef MEM_POOL_THREADS
+    _mem_remote_drain(manager);
+#endif
+    if(manager->pool.policy == SLAB_FIT){
+        return _mem_slab_alloc(manager, size);
+    }
+    if(manager->pool.policy == TAGGED_FIT){
+        return _mem_tag_alloc(manager, size);
+    }
+    if(manager->pool.policy == BITMAP_FIT){
+        return _mem_bitmap_alloc(manager, size);
+    }
+    if(manager->pool.num_gaps == 0){
         return NULL;
     }
     if (((float) manager -> used_nodes / manager -> total_nodes) > MEM_NODE_HEAP_FILL_FACTOR) {
-        alloc_status resize = _mem_resize_node_heap(manager);
+        alloc_status resize = _mem_resize_node_heap(manager, 0);
         if (resize != ALLOC_OK) {
             return NULL;
         }
     }
-    if (manager -> used_nodes >= manager -> total_nodes) {
+    if (manager -> node_free == 0) {
         return NULL;
     }
-    node_pt new_node;
-    int i = 0;
-    if(manager -> pool.policy == FIRST_FIT) {
-        node_pt this_node = manager -> node_heap;
-        while ((manager -> node_heap[i].allocated != 0) || (manager -> node_heap[i].alloc_record.size < size) && i < manager -> total_nodes) {
-            ++i;
-        }
-        if ( i == manager -> total_nodes) {
+    if (_mem_resize_alloc_map(manager) != ALLOC_OK) {
+        return NULL;
+    }
+    if (manager -> pool.policy == BUDDY_FIT) {
+        unsigned buddy_ix = _mem_buddy_alloc(manager, size);
+        if (buddy_ix == 0) {
             return NULL;
         }
-        new_node = &manager -> node_heap[i];
+        _mem_alloc_map_insert(manager, buddy_ix);
+#ifdef MEM_POOL_THREADS
+        _mem_node(manager, buddy_ix) -> gap_slot = MEM_NODE_LIVE;
+#endif
+        return (alloc_pt) _mem_node(manager, buddy_ix);
+    }
+    unsigned new_ix = 0;
+    if(manager -> pool.policy == FIRST_FIT) {
+        new_ix = _mem_find_first_gap(manager, size);
     }
     else if (manager -> pool.policy == BEST_FIT) {
-        if (manager ->pool.num_gaps > 0) {
-            while (i < manager -> pool.num_gaps && manager -> gap_ix[i+1].size >= size) {
-                if (manager -> gap_ix[i].size == size ) {
-                    break;
-                }
-                ++i;
-            }
-        } else {
-            return NULL;
-        }
-        new_node = manager -> gap_ix[i].node;
+        new_ix = _mem_find_best_gap(manager, size);
     }
-    manager -> pool.num_allocs++;
-    manager -> pool.alloc_size += size;
-    int size_of_gap = 0;
-    if(new_node -> alloc_record.size - size > 0) {
-        size_of_gap = new_node -> alloc_record.size - size;
+    else if (manager -> pool.policy == SEGREGATED_FIT) {
+        new_ix = _mem_find_seg_gap(manager, size);
+    }
+    else if (manager -> pool.policy == TLSF_FIT) {
+        new_ix = _mem_find_tlsf_gap(manager, size);
+    }
+    else if (manager -> pool.policy == NEXT_FIT) {
+        new_ix = _mem_find_next_gap(manager, size);
     }
-    if(_mem_remove_from_gap_ix(manager,size,new_node) != ALLOC_OK){
+    else if (manager -> pool.policy == WORST_FIT) {
+        new_ix = _mem_find_worst_gap(manager, size);
+    }
+    if (new_ix == 0) {
+        return NULL;
+    }
+    node_pt new_node = _mem_node(manager, new_ix);
+    size_t size_of_gap = new_node -> alloc_record.size - size;
+    // the remainder must be indexed once the node list holds it
+    if (size_of_gap > 0 && _mem_reserve_gap_ix(manager, size_of_gap) != ALLOC_OK) {
+        return NULL;
+    }
+    if(_mem_remove_from_gap_ix(manager, new_node -> alloc_record.size, new_ix) != ALLOC_OK){
         return NULL;
     }
+    manager -> pool.num_allocs++;
+    manager -> pool.alloc_size += size;
     new_node -> allocated = 1;
     new_node -> used = 1;
     new_node -> alloc_record.size = size;
+#ifdef MEM_POOL_THREADS
+    new_node -> gap_slot = MEM_NODE_LIVE;
+#endif
     if (size_of_gap > 0) {
-        int j = 0;
-        while (manager -> node_heap[j].used != 0) {
-            ++j;
-        }
-        node_pt new_gap_created = &manager -> node_heap[j];
-        if (new_gap_created != NULL) {
-            new_gap_created -> used = 1;
-            new_gap_created -> allocated = 0;
-            new_gap_created -> alloc_record.size = size_of_gap;
-        }
-        manager -> used_nodes++;
+        unsigned gap_created_ix = _mem_acquire_node(manager);
+        node_pt new_gap_created = _mem_node(manager, gap_created_ix);
+        new_gap_created -> alloc_record.size = size_of_gap;
+        new_gap_created -> alloc_record.mem = new_node -> alloc_record.mem + size;
         new_gap_created -> next = new_node -> next;
-        if(new_node -> next != NULL) {
-            new_node -> next -> prev = new_gap_created;
+        if(new_node -> next != 0) {
+            _mem_node(manager, new_node -> next) -> prev = gap_created_ix;
         }
-        new_node -> next = new_gap_created;
-        new_gap_created -> prev = new_node;
-        _mem_add_to_gap_ix(manager, size_of_gap, new_gap_created);
+        new_node -> next = gap_created_ix;
+        new_gap_created -> prev = new_ix;
+        _mem_add_to_gap_ix(manager, size_of_gap, gap_created_ix); // room reserved above
     }
+    _mem_alloc_map_insert(manager, new_ix);
+    manager -> rover = new_node -> next;
     return (alloc_pt) new_node;
 }
 
-alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
+static alloc_status _mem_del_alloc(pool_pt pool, alloc_pt alloc) {
     pool_mgr_pt manager = (pool_mgr_pt) pool;
-    node_pt delete_node;
-    node_pt node = (node_pt) alloc;
-    for(int i = 0; i < manager -> total_nodes; ++i) {
-        if (node == &manager -> node_heap[i]) {
-            delete_node = &manager -> node_heap[i];
-            break;
-        }
+    if(manager->pool.policy == SLAB_FIT){
+        return _mem_slab_free(manager, alloc);
+    }
+    if(manager->pool.policy == TAGGED_FIT){
+        return _mem_tag_free(manager, alloc);
+    }
+    if(manager->pool.policy == BITMAP_FIT){
+        return _mem_bitmap_free(manager, alloc);
+    }
+    // the allocation map holds exactly the nodes of live allocations, so
+    // taking the node out of it also checks that alloc is one of them
+    node_pt delete_node = (node_pt) alloc;
+    unsigned delete_ix = (delete_node != NULL) ? _mem_alloc_map_remove(manager, delete_node) : 0;
+    if(delete_ix == 0) {
+        return ALLOC_NOT_FREED;
     }
-    if(delete_node == NULL) {
+#ifdef MEM_POOL_THREADS
+    // a block in a thread's cache or on the remote free queue counts as
+    // allocated, but has been freed
+    if (__atomic_load_n(&delete_node -> gap_slot, __ATOMIC_RELAXED) != MEM_NODE_LIVE) {
+        _mem_alloc_map_insert(manager, delete_ix);
         return ALLOC_NOT_FREED;
     }
+    delete_node -> gap_slot = 0; // until it is added to the gap index
+#endif
     delete_node -> allocated = 0;
     manager -> pool.num_allocs--;
     manager -> pool.alloc_size -= delete_node -> alloc_record.size;
-    node_pt node_to_merge = NULL;
-    if (delete_node -> next != NULL && delete_node -> next -> used == 1 && delete_node -> next -> allocated == 0 ) {
-        node_to_merge = delete_node->next;
-        _mem_remove_from_gap_ix(manager, node_to_merge->alloc_record.size, node_to_merge);
-        delete_node->alloc_record.size = delete_node->alloc_record.size + delete_node->next->alloc_record.size;
-        node_to_merge->used = 0;
-        manager->used_nodes--;
+
+    if (manager -> pool.policy == BUDDY_FIT) {
+        _mem_buddy_free(manager, delete_ix);
+        return ALLOC_OK;
+    }
+
+    // merge the next gap, if any, into the freed node
+    unsigned merge_ix = delete_node -> next;
+    node_pt node_to_merge = _mem_node(manager, merge_ix);
+    if (merge_ix != 0 && node_to_merge -> allocated == 0) {
+        _mem_remove_from_gap_ix(manager, node_to_merge->alloc_record.size, merge_ix);
+        delete_node->alloc_record.size += node_to_merge->alloc_record.size;
+        delete_node->next = node_to_merge->next;
         if (node_to_merge->next) {
-            node_to_merge->next->prev = delete_node;
-            delete_node->next = node_to_merge->next;
-        } else {
-            delete_node->next = NULL;
+            _mem_node(manager, node_to_merge->next)->prev = delete_ix;
         }
-        node_to_merge->next = NULL;
-        node_to_merge->prev = NULL;
-        node_to_merge->alloc_record.mem = NULL;
-        node_to_merge->alloc_record.size = 0;
-    };
-    _mem_add_to_gap_ix(manager, delete_node ->alloc_record.size, delete_node);
-    node_pt previous_node;
-    if(delete_node -> prev != NULL && delete_node -> prev -> allocated == 0 && delete_node -> prev -> used == 1) {
-        previous_node = delete_node->prev;
-        _mem_remove_from_gap_ix(manager, previous_node->alloc_record.size, previous_node);
-        _mem_remove_from_gap_ix(manager, delete_node->alloc_record.size, delete_node);
-        previous_node->alloc_record.size = delete_node->alloc_record.size + delete_node->prev->alloc_record.size;
-        delete_node->alloc_record.mem = NULL;
-        delete_node->alloc_record.size = 0;
-        delete_node->used = 0;
-        delete_node->allocated = 0;
-        manager->used_nodes--;
+        _mem_release_node(manager, merge_ix);
+    }
+
+    // merge the freed node into the previous gap, if any
+    unsigned previous_ix = delete_node -> prev;
+    node_pt previous_node = _mem_node(manager, previous_ix);
+    if (previous_ix != 0 && previous_node -> allocated == 0) {
+        _mem_remove_from_gap_ix(manager, previous_node->alloc_record.size, previous_ix);
+        previous_node->alloc_record.size += delete_node->alloc_record.size;
+        previous_node->next = delete_node->next;
         if (delete_node->next) {
-            previous_node->next = delete_node->next;
-            delete_node->next->prev = previous_node;
-        } else {
-            previous_node->next = NULL;
+            _mem_node(manager, delete_node->next)->prev = previous_ix;
         }
-        delete_node->next = NULL;
-        delete_node->prev = NULL;
-        _mem_add_to_gap_ix(manager, previous_node->alloc_record.size, previous_node);
-    };
-    return ALLOC_OK;
+        _mem_release_node(manager, delete_ix);
+        delete_node = previous_node;
+        delete_ix = previous_ix;
+    }
+
+    return _mem_add_to_gap_ix(manager, delete_node->alloc_record.size, delete_ix);
 }
 
+static alloc_status _mem_del_alloc_addr(pool_pt pool, char *mem) {
+    pool_mgr_pt manager = (pool_mgr_pt) pool;
+    if(manager->pool.policy == SLAB_FIT || manager->pool.policy == LOCKFREE_SLAB_FIT){
+        // slab objects sit at fixed strides, no lookup needed
+        if(mem < manager->pool.mem || mem >= manager->pool.mem + manager->pool.total_size
+           || (size_t) (mem - manager->pool.mem) % manager->slab_stride != 0){
+            return ALLOC_NOT_FREED;
+        }
+        alloc_pt record = &manager->slab_records[(mem - manager->pool.mem) / manager->slab_stride];
+        return (manager->pool.policy == SLAB_FIT) ? _mem_slab_free(manager, record) : _mem_lockfree_free(manager, record);
+    }
+    if(manager->pool.policy == TAGGED_FIT){
+        // the header sits right below the allocation
+        if(mem < manager->pool.mem + sizeof(tag_t) || mem >= manager->pool.mem + manager->pool.total_size){
+            return ALLOC_NOT_FREED;
+        }
+        return _mem_tag_free(manager, (alloc_pt) (mem - sizeof(tag_t)));
+    }
+    if(manager->pool.policy == BITMAP_FIT){
+        // so does the record, in the granule before
+        if(mem < manager->pool.mem + MEM_BITMAP_GRANULE || mem >= manager->pool.mem + manager->pool.total_size){
+            return ALLOC_NOT_FREED;
+        }
+        return _mem_bitmap_free(manager, (alloc_pt) (mem - MEM_BITMAP_GRANULE));
+    }
+    node_pt node = _mem_alloc_map_find(manager, mem);
+    if(node == NULL){
+        return ALLOC_NOT_FREED;
+    }
+    return _mem_del_alloc(pool, (alloc_pt) node);
+}
 
-void mem_inspect_pool(pool_pt pool,
-                      pool_segment_pt *segments,
-                      unsigned *num_segments) {
+
+static void _mem_inspect_pool(pool_pt pool,
+                              pool_segment_pt *segments,
+                              unsigned *num_segments) {
     pool_mgr_pt  local_pool_mgr = (pool_mgr_pt) pool;
+    if(local_pool_mgr->pool.policy == SLAB_FIT){
+        _mem_slab_inspect(local_pool_mgr, segments, num_segments);
+        return;
+    }
+    if(local_pool_mgr->pool.policy == LOCKFREE_SLAB_FIT){
+        _mem_lockfree_inspect(local_pool_mgr, segments, num_segments);
+        return;
+    }
+    if(local_pool_mgr->pool.policy == TAGGED_FIT){
+        _mem_tag_inspect(local_pool_mgr, segments, num_segments);
+        return;
+    }
+    if(local_pool_mgr->pool.policy == BITMAP_FIT){
+        _mem_bitmap_inspect(local_pool_mgr, segments, num_segments);
+        return;
+    }
     pool_segment_pt  seg_list = calloc(local_pool_mgr->used_nodes, sizeof(pool_segment_t));
     if(seg_list == NULL){
         return;
     }
     pool_segment_pt seg = seg_list;
-    node_pt local_node = local_pool_mgr->node_heap;
+    node_pt local_node = _mem_node(local_pool_mgr, MEM_NODE_HEAD);
     for(int i = 0; i < local_pool_mgr->used_nodes; i++){
         seg->allocated = local_node->allocated;
-        seg->size = local_node->alloc_record.size;
-        local_node = local_node->next;
+        seg->size = (local_pool_mgr->pool.policy == BUDDY_FIT)
+                    ? _mem_buddy_extent(local_pool_mgr, local_node)
+                    : local_node->alloc_record.size;
+        local_node = _mem_node(local_pool_mgr, local_node->next);
         seg++;
 
     }
@@ -409,13 +1144,35 @@ void mem_inspect_pool(pool_pt pool,
      */
 }
 
+// whether mem_pool_close frees the pool: once the closing thread's cached
+// blocks and the frees queued by other threads are back, it must be empty;
+// other threads must have flushed their caches
+static int _mem_pool_closable(pool_mgr_pt pool_mgr) {
+#ifdef MEM_POOL_THREADS
+    if (pool_mgr->tcache) {
+        MEM_LOCK(&tcache_sets_lock);
+        tcache_pt tcache = _mem_tcache_find(pool_mgr, 0);
+        if (tcache != NULL) {
+            _mem_tcache_flush(tcache);
+        }
+        MEM_UNLOCK(&tcache_sets_lock);
+    }
+    _mem_remote_drain(pool_mgr);
+#endif
+    // note: an empty BUDDY_FIT pool is one free block per set bit of its size,
+    // and a LOCKFREE_SLAB_FIT pool only counts its gaps when inspected
+    return (pool_mgr->pool.num_gaps == 1 || pool_mgr->pool.policy == BUDDY_FIT
+            || pool_mgr->pool.policy == LOCKFREE_SLAB_FIT)
+           && pool_mgr->pool.num_allocs == 0;
+}
 
+// whether the policy keeps a node heap, whose nodes the per-thread caches
+// and the remote free queue mark their blocks in
+static int _mem_has_nodes(alloc_policy policy) {
+    return policy != SLAB_FIT && policy != LOCKFREE_SLAB_FIT
+           && policy != TAGGED_FIT && policy != BITMAP_FIT;
+}
 
-/***********************************/
-/*                                 */
-/* Definitions of static functions */
-/*                                 */
-/***********************************/
 //static alloc_status _mem_resize_pool_store() {
 //    //Check if the pool_store needs to be resized
 //    //  "necessary" to resize when size/cap > 0.75
@@ -510,16 +1267,84 @@ void mem_inspect_pool(pool_pt pool,
 
 
 
-static alloc_status _mem_resize_pool_store() {
+static alloc_status _mem_ctx_init(mem_ctx_pt ctx) {
+    // ensure that it's called only once until mem_free
+    // allocate the pool store with initial capacity
+    // note: holds pointers only, other functions to allocate/deallocate
+    MEM_LOCK(&ctx->pool_store_lock);
+    if(ctx->pool_store != NULL){
+        MEM_UNLOCK(&ctx->pool_store_lock);
+        return ALLOC_CALLED_AGAIN; //could this report incorrect status for dealloc errors
+    }
+    ctx->pool_store = (pool_mgr_pt *)calloc(MEM_POOL_STORE_INIT_CAPACITY, sizeof(pool_mgr_pt));
+    ctx->pool_store_free = (unsigned *)calloc(MEM_POOL_STORE_INIT_CAPACITY, sizeof(unsigned));
+    if(ctx->pool_store == NULL || ctx->pool_store_free == NULL){
+        free(ctx->pool_store_free);
+        free(ctx->pool_store);
+        ctx->pool_store_free = NULL;
+        ctx->pool_store = NULL;
+        MEM_UNLOCK(&ctx->pool_store_lock);
+        return ALLOC_FAIL;
+    }
+    ctx->pool_store_size = 0;
+    ctx->pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
+    ctx->pool_store_num_free = 0;
+    MEM_UNLOCK(&ctx->pool_store_lock);
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_ctx_free(mem_ctx_pt ctx) {
 
-    if (((float)pool_store_size / (float)pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR){
-        pool_store = (pool_mgr_pt *)realloc(pool_store, (sizeof(pool_mgr_pt)*(pool_store_capacity * MEM_EXPAND_FACTOR)));
-        if(pool_store == NULL){
-            return ALLOC_FAIL;
+    if(!ctx->pool_store){
+        return ALLOC_CALLED_AGAIN;
+    }
+        // each close takes the store lock itself
+        for (int i = 0; i < ctx->pool_store_size; i++) {
+            if(ctx->pool_store[i] != NULL){
+//                if(mem_pool_close((pool_pt)(pool_store[i])) != ALLOC_OK){
+//                    return ALLOC_FAIL;
+//                }
+                mem_pool_close((pool_pt) ctx->pool_store[i]);
+            }
+        }
+        MEM_LOCK(&ctx->pool_store_lock);
+        // pools still holding allocations outlive the context, so detach them
+        for (int i = 0; i < ctx->pool_store_size; i++) {
+            if(ctx->pool_store[i] != NULL){
+                ctx->pool_store[i]->ctx = NULL;
+            }
         }
-        //assert(pool_store);//double check that pool_store isnt NULL after realloc
+        free(ctx->pool_store);
+        free(ctx->pool_store_free);
+        ctx->pool_store_size = 0;
+        ctx->pool_store_capacity = 0;
+        ctx->pool_store_num_free = 0;
+        ctx->pool_store = NULL;
+        ctx->pool_store_free = NULL;
+        MEM_UNLOCK(&ctx->pool_store_lock);
+        return ALLOC_OK;
 
-        pool_store_capacity = pool_store_capacity * MEM_EXPAND_FACTOR;
+}
+
+// called with the store lock held, by _mem_add_to_pool_store
+static alloc_status _mem_resize_pool_store(mem_ctx_pt ctx) {
+    // a closed pool's slot is reused first
+    if (ctx->pool_store_num_free > 0) {
+        return ALLOC_OK;
+    }
+    if (((float)ctx->pool_store_size / (float)ctx->pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR){
+        unsigned capacity = ctx->pool_store_capacity * MEM_POOL_STORE_EXPAND_FACTOR;
+        pool_mgr_pt *store = (pool_mgr_pt *)realloc(ctx->pool_store, sizeof(pool_mgr_pt) * capacity);
+        if(store == NULL){
+            return ALLOC_FAIL;
+        }
+        ctx->pool_store = store;
+        unsigned *free_slots = (unsigned *)realloc(ctx->pool_store_free, sizeof(unsigned) * capacity);
+        if(free_slots == NULL){
+            return ALLOC_FAIL;
+        }
+        ctx->pool_store_free = free_slots;
+        ctx->pool_store_capacity = capacity;
         return ALLOC_OK;
 
     }
@@ -528,108 +1353,1908 @@ static alloc_status _mem_resize_pool_store() {
 
 }
 
-static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
+// on failure the pool is not in the store, and the caller frees it
+static alloc_status _mem_add_to_pool_store(mem_ctx_pt ctx, pool_mgr_pt pool_mgr) {
+    MEM_LOCK(&ctx->pool_store_lock);
+    if (_mem_resize_pool_store(ctx) != ALLOC_OK) {
+        MEM_UNLOCK(&ctx->pool_store_lock);
+        return ALLOC_FAIL;
+    }
+    unsigned slot = (ctx->pool_store_num_free > 0) ? ctx->pool_store_free[--ctx->pool_store_num_free] : ctx->pool_store_size++;
+    ctx->pool_store[slot] = pool_mgr;
+    pool_mgr->store_slot = slot;
+    pool_mgr->ctx = ctx;
+    MEM_UNLOCK(&ctx->pool_store_lock);
+#ifdef MEM_POOL_THREADS
+    pthread_mutex_init(&pool_mgr->lock, NULL);
+#endif
+    return ALLOC_OK;
+}
+
+// a pool that outlived mem_free or mem_ctx_destroy is detached (ctx is
+// NULL) and in no store
+static void _mem_remove_from_pool_store(pool_mgr_pt pool_mgr) {
+    mem_ctx_pt ctx = pool_mgr->ctx;
+    unsigned slot = pool_mgr->store_slot;
+    if (ctx != NULL) {
+        MEM_LOCK(&ctx->pool_store_lock);
+        if (ctx->pool_store != NULL && slot < ctx->pool_store_size && ctx->pool_store[slot] == pool_mgr) {
+            ctx->pool_store[slot] = NULL;
+            ctx->pool_store_free[ctx->pool_store_num_free++] = slot;
+        }
+        MEM_UNLOCK(&ctx->pool_store_lock);
+    }
+#ifdef MEM_POOL_THREADS
+    pthread_mutex_destroy(&pool_mgr->lock);
+#endif
+}
+
+// note: extra_nodes is the number of nodes the caller is about to take
+static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr, unsigned extra_nodes) {
     // see above
-    if(((float)pool_mgr->used_nodes/pool_mgr->total_nodes) > MEM_GAP_IX_FILL_FACTOR){
-        pool_mgr->node_heap = realloc(pool_mgr->node_heap, sizeof(node_t) * (pool_mgr->total_nodes * MEM_NODE_HEAP_EXPAND_FACTOR));
-        if(pool_mgr->node_heap == NULL){
+    // note: growth appends chunks, so nodes never move and no links need fixing
+    while(((float)(pool_mgr->used_nodes + extra_nodes)/pool_mgr->total_nodes) > MEM_NODE_HEAP_FILL_FACTOR){
+        if(_mem_add_node_chunk(pool_mgr) != ALLOC_OK){
             return ALLOC_FAIL;
         }
-        pool_mgr->total_nodes = pool_mgr->total_nodes * MEM_NODE_HEAP_EXPAND_FACTOR;
     }
     return ALLOC_OK;
 }
 
+// append a chunk of unused nodes, growing the directory if it is full
+static alloc_status _mem_add_node_chunk(pool_mgr_pt pool_mgr) {
+    if(pool_mgr->total_nodes > MEM_NODE_HEAP_MAX_NODES - MEM_NODE_HEAP_CHUNK_NODES){
+        return ALLOC_FAIL;
+    }
+    if(pool_mgr->node_heap_chunks == pool_mgr->node_heap_capacity){
+        unsigned capacity = (pool_mgr->node_heap_capacity != 0)
+                            ? pool_mgr->node_heap_capacity * MEM_NODE_HEAP_EXPAND_FACTOR
+                            : MEM_NODE_HEAP_INIT_CHUNKS;
+        node_pt *node_heap = realloc(pool_mgr->node_heap, sizeof(node_pt) * capacity);
+        if(node_heap == NULL){
+            return ALLOC_FAIL;
+        }
+        pool_mgr->node_heap = node_heap;
+        pool_mgr->node_heap_capacity = capacity;
+    }
+#ifdef MEM_POOL_THREADS
+    node_pt chunk = aligned_alloc(MEM_NODE_CHUNK_BYTES, MEM_NODE_CHUNK_BYTES);
+    if(chunk == NULL){
+        return ALLOC_FAIL;
+    }
+    memset(chunk, 0, MEM_NODE_CHUNK_BYTES);
+    if(_mem_chunk_set_add(pool_mgr, chunk) != ALLOC_OK){
+        free(chunk);
+        return ALLOC_FAIL;
+    }
+#else
+    node_pt chunk = calloc(MEM_NODE_HEAP_CHUNK_NODES, sizeof(node_t));
+    if(chunk == NULL){
+        return ALLOC_FAIL;
+    }
+#endif
+    pool_mgr->node_heap[pool_mgr->node_heap_chunks++] = chunk;
+    // push its nodes onto the unused list, lowest first, all but the sentinel
+    unsigned base = pool_mgr->total_nodes;
+    for (unsigned i = MEM_NODE_HEAP_CHUNK_NODES; i > 0 && base + i - 1 != 0; i--) {
+        chunk[i - 1].next = pool_mgr->node_free;
+        pool_mgr->node_free = base + i - 1;
+    }
+    pool_mgr->total_nodes += MEM_NODE_HEAP_CHUNK_NODES;
+    return ALLOC_OK;
+}
+
+static void _mem_free_node_heap(pool_mgr_pt pool_mgr) {
+    for (unsigned c = 0; c < pool_mgr->node_heap_chunks; c++) {
+        free(pool_mgr->node_heap[c]);
+    }
+    free(pool_mgr->node_heap);
+#ifdef MEM_POOL_THREADS
+    while (pool_mgr->chunk_set != NULL) {
+        chunk_set_pt outgrown = pool_mgr->chunk_set->outgrown;
+        free(pool_mgr->chunk_set);
+        pool_mgr->chunk_set = outgrown;
+    }
+#endif
+}
+
+// the node at index ix (the sentinel for 0, whose fields stay zero)
+static node_pt _mem_node(pool_mgr_pt pool_mgr, unsigned ix) {
+    return &pool_mgr->node_heap[ix / MEM_NODE_HEAP_CHUNK_NODES][ix % MEM_NODE_HEAP_CHUNK_NODES];
+}
+
+// home entry of the allocation at address mem (Fibonacci hashing of the offset)
+static unsigned _mem_alloc_map_home(pool_mgr_pt pool_mgr, const char *mem) {
+    unsigned long long offset = (unsigned long long) (mem - pool_mgr->pool.mem);
+    return (unsigned) ((offset * 0x9E3779B97F4A7C15ULL) >> 32) & (pool_mgr->alloc_map_capacity - 1);
+}
+
+static alloc_status _mem_resize_alloc_map(pool_mgr_pt pool_mgr) {
+    // note: sized for one more allocation, checked before the pool changes
+    if (pool_mgr->alloc_map_capacity != 0
+        && ((float) (pool_mgr->pool.num_allocs + 1) / pool_mgr->alloc_map_capacity) <= MEM_ALLOC_MAP_FILL_FACTOR) {
+        return ALLOC_OK;
+    }
+    unsigned *old_map = pool_mgr->alloc_map;
+    unsigned old_capacity = pool_mgr->alloc_map_capacity;
+    unsigned capacity = (old_capacity != 0)
+                        ? old_capacity * MEM_ALLOC_MAP_EXPAND_FACTOR
+                        : MEM_ALLOC_MAP_INIT_CAPACITY;
+    unsigned *alloc_map = calloc(capacity, sizeof(unsigned));
+    if (alloc_map == NULL) {
+        return ALLOC_FAIL;
+    }
+    pool_mgr->alloc_map = alloc_map;
+    pool_mgr->alloc_map_capacity = capacity;
+    for (unsigned u = 0; u < old_capacity; u++) {
+        if (old_map[u] != 0) {
+            _mem_alloc_map_insert(pool_mgr, old_map[u]);
+        }
+    }
+    free(old_map);
+    return ALLOC_OK;
+}
+
+// note: the caller has made room with _mem_resize_alloc_map
+static void _mem_alloc_map_insert(pool_mgr_pt pool_mgr, unsigned ix) {
+    unsigned mask = pool_mgr->alloc_map_capacity - 1;
+    unsigned u = _mem_alloc_map_home(pool_mgr, _mem_node(pool_mgr, ix)->alloc_record.mem);
+    while (pool_mgr->alloc_map[u] != 0) {
+        u = (u + 1) & mask;
+    }
+    pool_mgr->alloc_map[u] = ix;
+}
+
+// the index of node, taken out of the map; 0 if it is not in the map
+static unsigned _mem_alloc_map_remove(pool_mgr_pt pool_mgr, node_pt node) {
+    if (pool_mgr->alloc_map_capacity == 0) {
+        return 0;
+    }
+    unsigned *alloc_map = pool_mgr->alloc_map;
+    unsigned mask = pool_mgr->alloc_map_capacity - 1;
+    unsigned hole = _mem_alloc_map_home(pool_mgr, node->alloc_record.mem);
+    while (alloc_map[hole] == 0 || _mem_node(pool_mgr, alloc_map[hole]) != node) {
+        if (alloc_map[hole] == 0) {
+            return 0;
+        }
+        hole = (hole + 1) & mask;
+    }
+    unsigned ix = alloc_map[hole];
+    // close the hole by shifting back every later entry of the probe run
+    // that is allowed to sit there, so lookups never need tombstones
+    for (unsigned u = (hole + 1) & mask; alloc_map[u] != 0; u = (u + 1) & mask) {
+        unsigned home = _mem_alloc_map_home(pool_mgr, _mem_node(pool_mgr, alloc_map[u])->alloc_record.mem);
+        if (((u - home) & mask) >= ((u - hole) & mask)) {
+            alloc_map[hole] = alloc_map[u];
+            hole = u;
+        }
+    }
+    alloc_map[hole] = 0;
+    return ix;
+}
+
+// the allocated node at address mem, NULL if none
+// note: a zero-size record shares its address with the next segment,
+// and the address API never hands one out, so it is never the match
+static node_pt _mem_alloc_map_find(pool_mgr_pt pool_mgr, const char *mem) {
+    if (pool_mgr->alloc_map_capacity == 0) {
+        return NULL;
+    }
+    unsigned mask = pool_mgr->alloc_map_capacity - 1;
+    for (unsigned u = _mem_alloc_map_home(pool_mgr, mem);
+         pool_mgr->alloc_map[u] != 0;
+         u = (u + 1) & mask) {
+        node_pt node = _mem_node(pool_mgr, pool_mgr->alloc_map[u]);
+        if (node->alloc_record.mem == mem && node->alloc_record.size != 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr) {
     // see above
-    if (((float) pool_mgr->pool.num_gaps/pool_mgr->gap_ix_capacity) > MEM_GAP_IX_FILL_FACTOR){
-        pool_mgr->gap_ix = realloc(pool_mgr->gap_ix, sizeof(gap_t) * (pool_mgr->gap_ix_capacity * MEM_GAP_IX_EXPAND_FACTOR));
-        if(pool_mgr->gap_ix == NULL){
+    // note: slot 0 is the nil sentinel, so it doesn't count toward capacity
+    if (((float) (pool_mgr->pool.num_gaps + 1)/pool_mgr->gap_ix_capacity) > MEM_GAP_IX_FILL_FACTOR
+        || pool_mgr->gap_ix_free == 0){
+        unsigned capacity = pool_mgr->gap_ix_capacity * MEM_GAP_IX_EXPAND_FACTOR;
+        gap_pt gap_ix = realloc(pool_mgr->gap_ix, sizeof(gap_t) * capacity);
+        if(gap_ix == NULL){
             return ALLOC_FAIL;
         }
-        pool_mgr->gap_ix_capacity = pool_mgr->gap_ix_capacity * MEM_GAP_IX_EXPAND_FACTOR;
+        // chain the new slots onto the free list, lowest slot first
+        for (unsigned u = capacity - 1; u >= pool_mgr->gap_ix_capacity; u--) {
+            gap_ix[u].size = 0;
+            gap_ix[u].mem = NULL;
+            gap_ix[u].node = 0;
+            gap_ix[u].left = 0;
+            gap_ix[u].right = pool_mgr->gap_ix_free;
+            gap_ix[u].height = 0;
+            gap_ix[u].max_size = 0;
+            gap_ix[u].parent = 0;
+            pool_mgr->gap_ix_free = u;
+        }
+        pool_mgr->gap_ix = gap_ix;
+        pool_mgr->gap_ix_capacity = capacity;
     }
     return ALLOC_OK;
 }
 
-static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
-                                       size_t size,
-                                       node_pt node) {
+// strict ordering of gap index entries: by address for FIRST_FIT,
+// otherwise by (size, address)
+static int _mem_gap_less(pool_mgr_pt pool_mgr,
+                         size_t size1, const char *mem1,
+                         size_t size2, const char *mem2) {
+    if (pool_mgr->pool.policy == FIRST_FIT) {
+        return mem1 < mem2;
+    }
+    return size1 < size2 || (size1 == size2 && mem1 < mem2);
+}
+
+static void _mem_gap_ix_update(gap_pt gap_ix, unsigned t) {
+    gap_pt l = &gap_ix[gap_ix[t].left];
+    gap_pt r = &gap_ix[gap_ix[t].right];
+    gap_ix[t].height = 1 + ((l->height > r->height) ? l->height : r->height);
+    size_t max = (l->max_size > r->max_size) ? l->max_size : r->max_size;
+    gap_ix[t].max_size = (gap_ix[t].size > max) ? gap_ix[t].size : max;
+}
+
+static unsigned _mem_gap_ix_rotate_right(gap_pt gap_ix, unsigned t) {
+    unsigned l = gap_ix[t].left;
+    gap_ix[t].left = gap_ix[l].right;
+    gap_ix[gap_ix[t].left].parent = t;
+    gap_ix[l].right = t;
+    gap_ix[t].parent = l;
+    _mem_gap_ix_update(gap_ix, t);
+    _mem_gap_ix_update(gap_ix, l);
+    return l;
+}
+
+static unsigned _mem_gap_ix_rotate_left(gap_pt gap_ix, unsigned t) {
+    unsigned r = gap_ix[t].right;
+    gap_ix[t].right = gap_ix[r].left;
+    gap_ix[gap_ix[t].right].parent = t;
+    gap_ix[r].left = t;
+    gap_ix[t].parent = r;
+    _mem_gap_ix_update(gap_ix, t);
+    _mem_gap_ix_update(gap_ix, r);
+    return r;
+}
+
+// restore the AVL invariant at t, returning the new subtree root
+// note: the caller links the new subtree root to t's old parent
+static unsigned _mem_gap_ix_balance(gap_pt gap_ix, unsigned t) {
+    _mem_gap_ix_update(gap_ix, t);
+    int bal = (int) gap_ix[gap_ix[t].left].height - (int) gap_ix[gap_ix[t].right].height;
+    if (bal > 1) {
+        unsigned l = gap_ix[t].left;
+        if (gap_ix[gap_ix[l].left].height < gap_ix[gap_ix[l].right].height) {
+            gap_ix[t].left = _mem_gap_ix_rotate_left(gap_ix, l);
+            gap_ix[gap_ix[t].left].parent = t;
+        }
+        return _mem_gap_ix_rotate_right(gap_ix, t);
+    }
+    if (bal < -1) {
+        unsigned r = gap_ix[t].right;
+        if (gap_ix[gap_ix[r].right].height < gap_ix[gap_ix[r].left].height) {
+            gap_ix[t].right = _mem_gap_ix_rotate_right(gap_ix, r);
+            gap_ix[gap_ix[t].right].parent = t;
+        }
+        return _mem_gap_ix_rotate_left(gap_ix, t);
+    }
+    return t;
+}
+
+// rebalance the subtrees on the path from t up to the root, stopping
+// at the first one whose shape, height and largest gap are unchanged
+static void _mem_gap_ix_retrace(pool_mgr_pt pool_mgr, unsigned t) {
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    while (t != 0) {
+        unsigned p = gap_ix[t].parent;
+        unsigned height = gap_ix[t].height;
+        size_t max_size = gap_ix[t].max_size;
+        unsigned sub = _mem_gap_ix_balance(gap_ix, t);
+        if (sub == t && gap_ix[t].height == height && gap_ix[t].max_size == max_size) {
+            return;
+        }
+        gap_ix[sub].parent = p;
+        if (p == 0) {
+            pool_mgr->gap_ix_root = sub;
+        } else if (gap_ix[p].left == t) {
+            gap_ix[p].left = sub;
+        } else {
+            gap_ix[p].right = sub;
+        }
+        t = p;
+    }
+}
+
+// replace the child link of u's parent with v (v may be the sentinel)
+static void _mem_gap_ix_replace(pool_mgr_pt pool_mgr, unsigned u, unsigned v) {
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    unsigned p = gap_ix[u].parent;
+    if (p == 0) {
+        pool_mgr->gap_ix_root = v;
+    } else if (gap_ix[p].left == u) {
+        gap_ix[p].left = v;
+    } else {
+        gap_ix[p].right = v;
+    }
+    if (v != 0) {
+        gap_ix[v].parent = p;
+    }
+}
+
+// link slot in under the leaf its key belongs at
+static void _mem_gap_ix_insert(pool_mgr_pt pool_mgr, unsigned slot) {
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    unsigned p = 0;
+    unsigned t = pool_mgr->gap_ix_root;
+    int less = 0;
+    while (t != 0) {
+        p = t;
+        less = _mem_gap_less(pool_mgr, gap_ix[slot].size, gap_ix[slot].mem, gap_ix[t].size, gap_ix[t].mem);
+        t = less ? gap_ix[t].left : gap_ix[t].right;
+    }
+    gap_ix[slot].parent = p;
+    if (p == 0) {
+        pool_mgr->gap_ix_root = slot;
+    } else if (less) {
+        gap_ix[p].left = slot;
+    } else {
+        gap_ix[p].right = slot;
+    }
+    _mem_gap_ix_retrace(pool_mgr, p);
+}
+
+// unlink slot from the tree through its parent link, no key search
+static void _mem_gap_ix_remove(pool_mgr_pt pool_mgr, unsigned slot) {
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    unsigned l = gap_ix[slot].left, r = gap_ix[slot].right;
+    unsigned from; // lowest slot whose subtree changed
+    if (l == 0 || r == 0) {
+        from = gap_ix[slot].parent;
+        _mem_gap_ix_replace(pool_mgr, slot, (l != 0) ? l : r);
+    } else {
+        // move the successor into slot's place
+        unsigned succ = r;
+        while (gap_ix[succ].left != 0) {
+            succ = gap_ix[succ].left;
+        }
+        if (succ == r) {
+            from = succ;
+        } else {
+            from = gap_ix[succ].parent;
+            _mem_gap_ix_replace(pool_mgr, succ, gap_ix[succ].right);
+            gap_ix[succ].right = r;
+            gap_ix[r].parent = succ;
+        }
+        _mem_gap_ix_replace(pool_mgr, slot, succ);
+        gap_ix[succ].left = l;
+        gap_ix[l].parent = succ;
+        // succ stands in for slot, so its ancestors saw slot's values
+        gap_ix[succ].height = gap_ix[slot].height;
+        gap_ix[succ].max_size = gap_ix[slot].max_size;
+        if (from != succ) {
+            _mem_gap_ix_retrace(pool_mgr, from);
+        }
+        from = succ;
+    }
+    _mem_gap_ix_retrace(pool_mgr, from);
+}
+
+// size class of a gap or request of size bytes (size > 0)
+static unsigned _mem_seg_class(size_t size) {
+    return (unsigned) (8 * sizeof(unsigned long long) - 1 - __builtin_clzll(size));
+}
+
+// a SEGREGATED_FIT gap is appended to its class, so the newest is last
+// make room for one more gap in class k
+static alloc_status _mem_reserve_seg_class(pool_mgr_pt pool_mgr, unsigned k) {
+    if (pool_mgr->seg_counts[k] == pool_mgr->seg_capacities[k]) {
+        unsigned capacity = (pool_mgr->seg_capacities[k] == 0)
+                            ? MEM_SEG_CLASS_INIT_CAPACITY
+                            : pool_mgr->seg_capacities[k] * MEM_SEG_CLASS_EXPAND_FACTOR;
+        size_t *sizes = realloc(pool_mgr->seg_sizes[k], capacity * sizeof(size_t));
+        if (sizes == NULL) {
+            return ALLOC_FAIL;
+        }
+        pool_mgr->seg_sizes[k] = sizes;
+        unsigned *nodes = realloc(pool_mgr->seg_nodes[k], capacity * sizeof(unsigned));
+        if (nodes == NULL) {
+            return ALLOC_FAIL;
+        }
+        pool_mgr->seg_nodes[k] = nodes;
+        pool_mgr->seg_capacities[k] = capacity;
+    }
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_add_to_seg_class(pool_mgr_pt pool_mgr, size_t size, unsigned ix) {
+    unsigned k = _mem_seg_class(size);
+    if (_mem_reserve_seg_class(pool_mgr, k) != ALLOC_OK) {
+        return ALLOC_FAIL;
+    }
+    unsigned pos = pool_mgr->seg_counts[k]++;
+    pool_mgr->seg_sizes[k][pos] = size;
+    pool_mgr->seg_nodes[k][pos] = ix;
+    _mem_node(pool_mgr, ix)->gap_slot = pos;
+    pool_mgr->seg_map |= 1ULL << k;
+    return ALLOC_OK;
+}
+
+// the last gap of the class moves into the hole
+static void _mem_remove_from_seg_class(pool_mgr_pt pool_mgr, size_t size, unsigned ix) {
+    unsigned k = _mem_seg_class(size);
+    unsigned pos = _mem_node(pool_mgr, ix)->gap_slot;
+    unsigned last = --pool_mgr->seg_counts[k];
+    if (pos != last) {
+        pool_mgr->seg_sizes[k][pos] = pool_mgr->seg_sizes[k][last];
+        pool_mgr->seg_nodes[k][pos] = pool_mgr->seg_nodes[k][last];
+        _mem_node(pool_mgr, pool_mgr->seg_nodes[k][pos])->gap_slot = pos;
+    }
+    if (last == 0) {
+        pool_mgr->seg_map &= ~(1ULL << k);
+    }
+}
+
+// position of the last of the n sizes that is at least size, n if none;
+// with 64-bit sizes, whole vectors are compared at a time, as signed
+// lanes since there is no unsigned compare: flipping the top bit of both
+// sides keeps their order, and size - 1 turns >= into >
+static unsigned _mem_seg_scan(const size_t *sizes, unsigned n, size_t size) {
+    unsigned i = n;
+#if defined(__AVX2__) && __SIZEOF_SIZE_T__ == 8
+    const __m256i flip = _mm256_set1_epi64x((long long) (1ULL << 63));
+    const __m256i key = _mm256_xor_si256(_mm256_set1_epi64x((long long) (size - 1)), flip);
+    while (i >= 4) {
+        i -= 4;
+        __m256i lanes = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (sizes + i)), flip);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(lanes, key)));
+        if (mask) {
+            return i + 31 - __builtin_clz((unsigned) mask);
+        }
+    }
+#elif defined(__SSE4_2__) && __SIZEOF_SIZE_T__ == 8
+    const __m128i flip = _mm_set1_epi64x((long long) (1ULL << 63));
+    const __m128i key = _mm_xor_si128(_mm_set1_epi64x((long long) (size - 1)), flip);
+    while (i >= 2) {
+        i -= 2;
+        __m128i lanes = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (sizes + i)), flip);
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(lanes, key)));
+        if (mask) {
+            return i + 31 - __builtin_clz((unsigned) mask);
+        }
+    }
+#endif
+    while (i > 0) {
+        i--;
+        if (sizes[i] >= size) {
+            return i;
+        }
+    }
+    return n;
+}
+
+// TLSF class of a gap of size bytes
+static void _mem_tlsf_mapping(size_t size, unsigned *fl, unsigned *sl) {
+    if (size < MEM_TLSF_SL_COUNT) {
+        *fl = 0;
+        *sl = (unsigned) size;
+    } else {
+        unsigned msb = (unsigned) (8 * sizeof(unsigned long long) - 1 - __builtin_clzll(size));
+        *fl = msb - MEM_TLSF_SL_LOG2 + 1;
+        *sl = (unsigned) (size >> (msb - MEM_TLSF_SL_LOG2)) ^ MEM_TLSF_SL_COUNT;
+    }
+}
+
+static void _mem_add_to_tlsf(pool_mgr_pt pool_mgr, size_t size, unsigned ix) {
+    unsigned fl, sl;
+    _mem_tlsf_mapping(size, &fl, &sl);
+    node_pt node = _mem_node(pool_mgr, ix);
+    node->gap_prev = 0;
+    node->gap_next = pool_mgr->tlsf_lists[fl][sl];
+    if (node->gap_next) {
+        _mem_node(pool_mgr, node->gap_next)->gap_prev = ix;
+    }
+    pool_mgr->tlsf_lists[fl][sl] = ix;
+    pool_mgr->tlsf_sl_map[fl] |= 1U << sl;
+    pool_mgr->tlsf_fl_map |= 1ULL << fl;
+}
+
+static void _mem_remove_from_tlsf(pool_mgr_pt pool_mgr, size_t size, unsigned ix) {
+    unsigned fl, sl;
+    _mem_tlsf_mapping(size, &fl, &sl);
+    node_pt node = _mem_node(pool_mgr, ix);
+    if (node->gap_prev) {
+        _mem_node(pool_mgr, node->gap_prev)->gap_next = node->gap_next;
+    } else {
+        pool_mgr->tlsf_lists[fl][sl] = node->gap_next;
+        if (node->gap_next == 0) {
+            pool_mgr->tlsf_sl_map[fl] &= ~(1U << sl);
+            if (pool_mgr->tlsf_sl_map[fl] == 0) {
+                pool_mgr->tlsf_fl_map &= ~(1ULL << fl);
+            }
+        }
+    }
+    if (node->gap_next) {
+        _mem_node(pool_mgr, node->gap_next)->gap_prev = node->gap_prev;
+    }
+    node->gap_next = node->gap_prev = 0;
+}
+
+// free blocks of a BUDDY_FIT pool are gaps whose size is 2^order
+static void _mem_add_to_buddy_list(pool_mgr_pt pool_mgr, size_t size, unsigned ix) {
+    unsigned k = (unsigned) __builtin_ctzll(size);
+    node_pt node = _mem_node(pool_mgr, ix);
+    node->gap_prev = 0;
+    node->gap_next = pool_mgr->buddy_lists[k];
+    if (node->gap_next) {
+        _mem_node(pool_mgr, node->gap_next)->gap_prev = ix;
+    }
+    pool_mgr->buddy_lists[k] = ix;
+    pool_mgr->buddy_map |= 1ULL << k;
+    pool_mgr->buddy_counts[k]++;
+}
+
+static void _mem_remove_from_buddy_list(pool_mgr_pt pool_mgr, size_t size, unsigned ix) {
+    unsigned k = (unsigned) __builtin_ctzll(size);
+    node_pt node = _mem_node(pool_mgr, ix);
+    if (node->gap_prev) {
+        _mem_node(pool_mgr, node->gap_prev)->gap_next = node->gap_next;
+    } else {
+        pool_mgr->buddy_lists[k] = node->gap_next;
+        if (node->gap_next == 0) {
+            pool_mgr->buddy_map &= ~(1ULL << k);
+        }
+    }
+    if (node->gap_next) {
+        _mem_node(pool_mgr, node->gap_next)->gap_prev = node->gap_prev;
+    }
+    node->gap_next = node->gap_prev = 0;
+    pool_mgr->buddy_counts[k]--;
+}
+
+static alloc_status _mem_add_to_gap_tree(pool_mgr_pt pool_mgr,
+                                         size_t size,
+                                         unsigned ix) {
     if(_mem_resize_gap_ix(pool_mgr) != ALLOC_OK){
         return ALLOC_FAIL;
     }
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].size = size;
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].node = node;
-    pool_mgr->pool.num_gaps++;
-    if(_mem_sort_gap_ix(pool_mgr) != ALLOC_OK){
+    // take a slot off the free list
+    unsigned slot = pool_mgr->gap_ix_free;
+    gap_pt gap = &pool_mgr->gap_ix[slot];
+    pool_mgr->gap_ix_free = gap->right;
+    node_pt node = _mem_node(pool_mgr, ix);
+    gap->size = size;
+    gap->mem = node->alloc_record.mem;
+    gap->node = ix;
+    gap->left = gap->right = 0;
+    gap->height = 1;
+    gap->max_size = size;
+    node->gap_slot = slot;
+    // insert it into the tree
+    _mem_gap_ix_insert(pool_mgr, slot);
+    unsigned max = pool_mgr->gap_ix_max;
+    if (max == 0 || _mem_gap_less(pool_mgr, pool_mgr->gap_ix[max].size, pool_mgr->gap_ix[max].mem, size, gap->mem)) {
+        pool_mgr->gap_ix_max = slot;
+    }
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_remove_from_gap_tree(pool_mgr_pt pool_mgr,
+                                              unsigned ix) {
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    node_pt node = _mem_node(pool_mgr, ix);
+    unsigned slot = node->gap_slot;
+    if (slot == 0 || gap_ix[slot].node != ix) {
         return ALLOC_FAIL;
     }
+    if (slot == pool_mgr->gap_ix_max) {
+        // the tail has no right child, so its predecessor is the tail of
+        // its left subtree, or else its parent
+        unsigned t = gap_ix[slot].left;
+        if (t == 0) {
+            t = gap_ix[slot].parent;
+        }
+        while (t != 0 && gap_ix[t].right != 0 && gap_ix[t].right != slot) {
+            t = gap_ix[t].right;
+        }
+        pool_mgr->gap_ix_max = t;
+    }
+    _mem_gap_ix_remove(pool_mgr, slot);
+    node->gap_slot = 0;
+    // return the slot to the free list
+    pool_mgr->gap_ix[slot].size = 0;
+    pool_mgr->gap_ix[slot].mem = NULL;
+    pool_mgr->gap_ix[slot].node = 0;
+    pool_mgr->gap_ix[slot].left = 0;
+    pool_mgr->gap_ix[slot].right = pool_mgr->gap_ix_free;
+    pool_mgr->gap_ix[slot].height = 0;
+    pool_mgr->gap_ix[slot].max_size = 0;
+    pool_mgr->gap_ix[slot].parent = 0;
+    pool_mgr->gap_ix_free = slot;
     return ALLOC_OK;
+}
 
-    // expand the gap index, if necessary (call the function)
-    // add the entry at the end
-    // update metadata (num_gaps)
-    // sort the gap index (call the function)
-    // check success
+// the gap index of a pool is the structure its policy searches
+// make room to index one more gap of size bytes, so that adding it
+// cannot fail; the size-class lists other than SEGREGATED_FIT's link
+// through the nodes and need none
+static alloc_status _mem_reserve_gap_ix(pool_mgr_pt pool_mgr, size_t size) {
+    switch (pool_mgr->pool.policy) {
+        case SEGREGATED_FIT:
+            return _mem_reserve_seg_class(pool_mgr, _mem_seg_class(size));
+        case TLSF_FIT:
+        case BUDDY_FIT:
+        case NEXT_FIT:
+            return ALLOC_OK;
+        default:
+            return _mem_resize_gap_ix(pool_mgr);
+    }
+}
 
+static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
+                                       size_t size,
+                                       unsigned ix) {
+    switch (pool_mgr->pool.policy) {
+        case SEGREGATED_FIT:
+            if (_mem_add_to_seg_class(pool_mgr, size, ix) != ALLOC_OK) {
+                return ALLOC_FAIL;
+            }
+            break;
+        case TLSF_FIT:
+            _mem_add_to_tlsf(pool_mgr, size, ix);
+            break;
+        case BUDDY_FIT:
+            _mem_add_to_buddy_list(pool_mgr, size, ix);
+            break;
+        case NEXT_FIT:
+            break; // the roving search walks the node list itself
+        default:
+            if (_mem_add_to_gap_tree(pool_mgr, size, ix) != ALLOC_OK) {
+                return ALLOC_FAIL;
+            }
+    }
+    pool_mgr->pool.num_gaps++;
+    return ALLOC_OK;
 }
 
 static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
                                             size_t size,
-                                            node_pt node) {
-    int index = -1;
-    for (int i = 0; i < pool_mgr->pool.num_gaps; i++) {
-        if(pool_mgr->gap_ix[i].node == node) {
-            index = i;
+                                            unsigned ix) {
+    switch (pool_mgr->pool.policy) {
+        case SEGREGATED_FIT:
+            _mem_remove_from_seg_class(pool_mgr, size, ix);
+            break;
+        case TLSF_FIT:
+            _mem_remove_from_tlsf(pool_mgr, size, ix);
+            break;
+        case BUDDY_FIT:
+            _mem_remove_from_buddy_list(pool_mgr, size, ix);
+            break;
+        case NEXT_FIT:
+            break;
+        default:
+            if (_mem_remove_from_gap_tree(pool_mgr, ix) != ALLOC_OK) {
+                return ALLOC_FAIL;
+            }
+    }
+    pool_mgr->pool.num_gaps--;
+    return ALLOC_OK;
+}
+
+// lowest-address gap of at least size bytes: descend into the leftmost
+// subtree whose largest gap fits
+static unsigned _mem_find_first_gap(pool_mgr_pt pool_mgr, size_t size) {
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    unsigned t = pool_mgr->gap_ix_root;
+    if (t == 0 || gap_ix[t].max_size < size) {
+        return 0;
+    }
+    for (;;) {
+        MEM_STAT(pool_mgr->search_steps++);
+        if (gap_ix[t].left != 0 && gap_ix[gap_ix[t].left].max_size >= size) {
+            t = gap_ix[t].left;
+        } else if (gap_ix[t].size >= size) {
+            return gap_ix[t].node;
+        } else {
+            t = gap_ix[t].right; // the subtree max guarantees a fit on the right
+        }
+    }
+}
+
+// smallest gap of at least size bytes, lowest address among equals
+static unsigned _mem_find_best_gap(pool_mgr_pt pool_mgr, size_t size) {
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    unsigned best = 0;
+    unsigned t = pool_mgr->gap_ix_root;
+    while (t != 0) {
+        if (gap_ix[t].size >= size) {
+            best = t;
+            t = gap_ix[t].left;
+        } else {
+            t = gap_ix[t].right;
+        }
+    }
+    return gap_ix[best].node; // the sentinel's node is 0
+}
+
+// newest fitting gap in the request's own size class, otherwise the
+// newest of the smallest non-empty larger class, all of whose gaps fit
+static unsigned _mem_find_seg_gap(pool_mgr_pt pool_mgr, size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+    unsigned k = _mem_seg_class(size);
+    unsigned n = pool_mgr->seg_counts[k];
+    unsigned pos = _mem_seg_scan(pool_mgr->seg_sizes[k], n, size);
+    if (pos < n) {
+        return pool_mgr->seg_nodes[k][pos];
+    }
+    if (k + 1 >= MEM_SEG_LIST_CLASSES) {
+        return 0;
+    }
+    unsigned long long larger = pool_mgr->seg_map & (~0ULL << (k + 1));
+    if (larger == 0) {
+        return 0;
+    }
+    k = (unsigned) __builtin_ctzll(larger);
+    return pool_mgr->seg_nodes[k][pool_mgr->seg_counts[k] - 1];
+}
+
+// good fit in two bitmap lookups: the request is rounded up to the next
+// class boundary, so the head of any class at or above it is big enough
+static unsigned _mem_find_tlsf_gap(pool_mgr_pt pool_mgr, size_t size) {
+    unsigned fl, sl;
+    if (size >= MEM_TLSF_SL_COUNT) {
+        unsigned msb = (unsigned) (8 * sizeof(unsigned long long) - 1 - __builtin_clzll(size));
+        size_t round = ((size_t) 1 << (msb - MEM_TLSF_SL_LOG2)) - 1;
+        if (size + round < size) {
+            return 0;
+        }
+        size += round;
+    }
+    _mem_tlsf_mapping(size, &fl, &sl);
+    unsigned sl_map = pool_mgr->tlsf_sl_map[fl] & (~0U << sl);
+    if (sl_map == 0) {
+        unsigned long long fl_map = (fl + 1 < MEM_TLSF_FL_COUNT) ? pool_mgr->tlsf_fl_map & (~0ULL << (fl + 1)) : 0;
+        if (fl_map == 0) {
+            return 0;
+        }
+        fl = (unsigned) __builtin_ctzll(fl_map);
+        sl_map = pool_mgr->tlsf_sl_map[fl];
+    }
+    return pool_mgr->tlsf_lists[fl][__builtin_ctz(sl_map)];
+}
+
+// largest gap, highest address among equals, read off the cached tail
+static unsigned _mem_find_worst_gap(pool_mgr_pt pool_mgr, size_t size) {
+    gap_pt max = &pool_mgr->gap_ix[pool_mgr->gap_ix_max];
+    return (max->node != 0 && max->size >= size) ? max->node : 0;
+}
+
+// first fitting gap in address order, starting where the last search
+// left off and wrapping around to the head of the pool
+static unsigned _mem_find_next_gap(pool_mgr_pt pool_mgr, size_t size) {
+    unsigned start = (pool_mgr->rover) ? pool_mgr->rover : MEM_NODE_HEAD;
+    unsigned ix = start;
+    do {
+        MEM_STAT(pool_mgr->search_steps++);
+        node_pt node = _mem_node(pool_mgr, ix);
+        if (! node->allocated && node->alloc_record.size >= size) {
+            return ix;
+        }
+        ix = (node->next) ? node->next : MEM_NODE_HEAD;
+    } while (ix != start);
+    return 0;
+}
+
+// return a node merged away by mem_del_alloc to the unused list
+// note: merged nodes are always absorbed by their predecessor
+static void _mem_release_node(pool_mgr_pt pool_mgr, unsigned ix) {
+    node_pt node = _mem_node(pool_mgr, ix);
+    if (pool_mgr->rover == ix) {
+        pool_mgr->rover = node->prev;
+    }
+    node->alloc_record.mem = NULL;
+    node->alloc_record.size = 0;
+    node->used = 0;
+    node->allocated = 0;
+    node->prev = 0;
+    node->gap_next = 0;
+    node->gap_prev = 0;
+    node->next = pool_mgr->node_free;
+    pool_mgr->node_free = ix;
+    pool_mgr->used_nodes--;
+}
+
+// take an unused node off the node heap as a fresh gap
+// note: the caller has made room with _mem_resize_node_heap
+static unsigned _mem_acquire_node(pool_mgr_pt pool_mgr) {
+    unsigned ix = pool_mgr->node_free;
+    node_pt node = _mem_node(pool_mgr, ix);
+    pool_mgr->node_free = node->next;
+    node->next = 0;
+    node->used = 1;
+    node->allocated = 0;
+    pool_mgr->used_nodes++;
+    return ix;
+}
+
+// size of the block a BUDDY_FIT node spans, allocated or not
+static size_t _mem_buddy_extent(pool_mgr_pt pool_mgr, node_pt node) {
+    char *end = (node->next) ? _mem_node(pool_mgr, node->next)->alloc_record.mem
+                             : pool_mgr->pool.mem + pool_mgr->pool.total_size;
+    return (size_t) (end - node->alloc_record.mem);
+}
+
+// carve the pool into the largest aligned power-of-two blocks, one per
+// set bit of the pool size, largest first; these are never merged further
+static alloc_status _mem_buddy_init(pool_mgr_pt pool_mgr) {
+    size_t total = pool_mgr->pool.total_size;
+    if (_mem_resize_node_heap(pool_mgr, (unsigned) __builtin_popcountll(total)) != ALLOC_OK) {
+        return ALLOC_FAIL;
+    }
+    unsigned ix = MEM_NODE_HEAD;
+    size_t offset = 0;
+    while (offset < total) {
+        node_pt node = _mem_node(pool_mgr, ix);
+        size_t block = (size_t) 1 << (8 * sizeof(unsigned long long) - 1 - __builtin_clzll(total - offset));
+        node->alloc_record.size = block;
+        if (offset + block < total) {
+            unsigned rest_ix = _mem_acquire_node(pool_mgr);
+            node_pt rest = _mem_node(pool_mgr, rest_ix);
+            rest->alloc_record.mem = node->alloc_record.mem + block;
+            rest->prev = ix;
+            node->next = rest_ix;
+        }
+        _mem_add_to_gap_ix(pool_mgr, block, ix);
+        offset += block;
+        ix = node->next;
+    }
+    return ALLOC_OK;
+}
+
+// take the smallest free block that fits and halve it down to the
+// request's order, freeing the upper half at each step
+static unsigned _mem_buddy_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    unsigned order = (size > 1)
+                     ? (unsigned) (8 * sizeof(unsigned long long) - __builtin_clzll(size - 1))
+                     : 0;
+    if (order >= MEM_BUDDY_ORDERS) {
+        return 0;
+    }
+    unsigned long long fits = pool_mgr->buddy_map & (~0ULL << order);
+    if (fits == 0) {
+        return 0;
+    }
+    unsigned k = (unsigned) __builtin_ctzll(fits);
+    if (_mem_resize_node_heap(pool_mgr, k - order) != ALLOC_OK) {
+        return 0;
+    }
+    unsigned ix = pool_mgr->buddy_lists[k];
+    node_pt node = _mem_node(pool_mgr, ix);
+    _mem_remove_from_gap_ix(pool_mgr, node->alloc_record.size, ix);
+    while (k > order) {
+        k--;
+        unsigned upper_ix = _mem_acquire_node(pool_mgr);
+        node_pt upper = _mem_node(pool_mgr, upper_ix);
+        upper->alloc_record.size = (size_t) 1 << k;
+        upper->alloc_record.mem = node->alloc_record.mem + ((size_t) 1 << k);
+        upper->next = node->next;
+        if (node->next) {
+            _mem_node(pool_mgr, node->next)->prev = upper_ix;
+        }
+        upper->prev = ix;
+        node->next = upper_ix;
+        _mem_add_to_gap_ix(pool_mgr, upper->alloc_record.size, upper_ix);
+    }
+    node->allocated = 1;
+    node->alloc_record.size = size;
+    pool_mgr->pool.num_allocs++;
+    pool_mgr->pool.alloc_size += size;
+    return ix;
+}
+
+// merge a freed block with its buddy for as long as the buddy is a
+// whole free block; the buddy is always a physical neighbour
+static void _mem_buddy_free(pool_mgr_pt pool_mgr, unsigned ix) {
+    node_pt node = _mem_node(pool_mgr, ix);
+    size_t block = _mem_buddy_extent(pool_mgr, node);
+    for (;;) {
+        size_t offset = (size_t) (node->alloc_record.mem - pool_mgr->pool.mem);
+        unsigned buddy_ix = (offset & block) ? node->prev : node->next;
+        node_pt buddy = _mem_node(pool_mgr, buddy_ix);
+        if (buddy_ix == 0 || buddy->allocated
+            || buddy->alloc_record.size != block
+            || buddy->alloc_record.mem != pool_mgr->pool.mem + (offset ^ block)) {
             break;
         }
+        _mem_remove_from_gap_ix(pool_mgr, block, buddy_ix);
+        unsigned lower_ix = (offset & block) ? buddy_ix : ix;
+        unsigned upper_ix = (offset & block) ? ix : buddy_ix;
+        node_pt lower = _mem_node(pool_mgr, lower_ix);
+        node_pt upper = _mem_node(pool_mgr, upper_ix);
+        lower->next = upper->next;
+        if (upper->next) {
+            _mem_node(pool_mgr, upper->next)->prev = lower_ix;
+        }
+        _mem_release_node(pool_mgr, upper_ix);
+        ix = lower_ix;
+        node = lower;
+        block <<= 1;
+    }
+    node->alloc_record.size = block;
+    _mem_add_to_gap_ix(pool_mgr, block, ix);
+}
+
+// SLAB_FIT and LOCKFREE_SLAB_FIT differ only in their free lists
+static pool_pt _mem_slab_pool_open(mem_ctx_pt ctx, size_t obj_size, size_t count, alloc_policy policy) {
+    if (ctx->pool_store == NULL || obj_size == 0 || count == 0) {
+        return NULL;
+    }
+    // the lock-free list links objects by 32-bit index, count meaning none
+    if (policy == LOCKFREE_SLAB_FIT && count >= 0xFFFFFFFFu) {
+        return NULL;
+    }
+    // objects are word-aligned and a free one must hold the free list link
+    size_t stride = (obj_size + sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t);
+    size_t words = (count + 63) / 64;
+    if (stride * count / count != stride) {
+        return NULL;
+    }
+    pool_mgr_pt new_mem_pool_manager = calloc(1, sizeof(pool_mgr_t));
+    if (new_mem_pool_manager == NULL) {
+        return NULL;
+    }
+    new_mem_pool_manager->pool.mem = malloc(stride * count);
+    new_mem_pool_manager->slab_records = calloc(count, sizeof(alloc_t));
+    new_mem_pool_manager->slab_map = calloc(words, sizeof(unsigned long long));
+    if (policy == LOCKFREE_SLAB_FIT) {
+        new_mem_pool_manager->slab_next = calloc(count, sizeof(unsigned));
+    }
+    if (new_mem_pool_manager->pool.mem == NULL
+       || new_mem_pool_manager->slab_records == NULL
+       || new_mem_pool_manager->slab_map == NULL
+       || (policy == LOCKFREE_SLAB_FIT && new_mem_pool_manager->slab_next == NULL)) {
+        free(new_mem_pool_manager->slab_next);
+        free(new_mem_pool_manager->slab_map);
+        free(new_mem_pool_manager->slab_records);
+        free(new_mem_pool_manager->pool.mem);
+        free(new_mem_pool_manager);
+        return NULL;
+    }
+    // thread every object onto the free list, lowest address first
+    for (size_t i = 0; i < count; i++) {
+        size_t next = i + 1;
+        new_mem_pool_manager->slab_records[i].mem = new_mem_pool_manager->pool.mem + i * stride;
+        if (policy == LOCKFREE_SLAB_FIT) {
+            new_mem_pool_manager->slab_next[i] = (unsigned) next;
+        } else {
+            memcpy(new_mem_pool_manager->slab_records[i].mem, &next, sizeof(size_t));
+        }
+    }
+    new_mem_pool_manager->slab_free = 0;
+    new_mem_pool_manager->slab_head = 0;
+    new_mem_pool_manager->slab_obj_size = obj_size;
+    new_mem_pool_manager->slab_stride = stride;
+    new_mem_pool_manager->slab_count = count;
+    new_mem_pool_manager->pool.policy = policy;
+    new_mem_pool_manager->pool.total_size = stride * count;
+    new_mem_pool_manager->pool.alloc_size = 0;
+    new_mem_pool_manager->pool.num_allocs = 0;
+    new_mem_pool_manager->pool.num_gaps = 1;
+    if (_mem_add_to_pool_store(ctx, new_mem_pool_manager) != ALLOC_OK) {
+        free(new_mem_pool_manager->slab_next);
+        free(new_mem_pool_manager->slab_map);
+        free(new_mem_pool_manager->slab_records);
+        free(new_mem_pool_manager->pool.mem);
+        free(new_mem_pool_manager);
+        return NULL;
+    }
+
+    return (pool_pt)new_mem_pool_manager;
+}
+
+static int _mem_slab_is_free(pool_mgr_pt pool_mgr, size_t i) {
+    return ! (pool_mgr->slab_map[i / 64] & (1ULL << (i % 64)));
+}
+
+// a free object only changes the gap count through its neighbours:
+// taking it out of a run of free objects can split or end the run
+static int _mem_slab_gap_delta(pool_mgr_pt pool_mgr, size_t i) {
+    int left = (i > 0) && _mem_slab_is_free(pool_mgr, i - 1);
+    int right = (i + 1 < pool_mgr->slab_count) && _mem_slab_is_free(pool_mgr, i + 1);
+    return left + right - 1;
+}
+
+// pop the free list head
+static alloc_pt _mem_slab_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    size_t i = pool_mgr->slab_free;
+    if (i == pool_mgr->slab_count || size > pool_mgr->slab_obj_size) {
+        return NULL;
+    }
+    alloc_pt record = &pool_mgr->slab_records[i];
+    memcpy(&pool_mgr->slab_free, record->mem, sizeof(size_t));
+    pool_mgr->pool.num_gaps += _mem_slab_gap_delta(pool_mgr, i);
+    pool_mgr->slab_map[i / 64] |= 1ULL << (i % 64);
+    record->size = size;
+    pool_mgr->pool.num_allocs++;
+    pool_mgr->pool.alloc_size += size;
+    return record;
+}
+
+// push onto the free list head, after checking the record is ours and live
+static alloc_status _mem_slab_free(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    if (alloc < pool_mgr->slab_records || alloc >= pool_mgr->slab_records + pool_mgr->slab_count) {
+        return ALLOC_NOT_FREED;
+    }
+    size_t i = (size_t) (alloc - pool_mgr->slab_records);
+    if (_mem_slab_is_free(pool_mgr, i)) {
+        return ALLOC_NOT_FREED;
+    }
+    pool_mgr->slab_map[i / 64] &= ~(1ULL << (i % 64));
+    pool_mgr->pool.num_gaps -= _mem_slab_gap_delta(pool_mgr, i);
+    pool_mgr->pool.num_allocs--;
+    pool_mgr->pool.alloc_size -= alloc->size;
+    alloc->size = 0;
+    memcpy(alloc->mem, &pool_mgr->slab_free, sizeof(size_t));
+    pool_mgr->slab_free = i;
+    return ALLOC_OK;
+}
+
+// one segment per allocated object, one per run of free objects
+static void _mem_slab_inspect(pool_mgr_pt pool_mgr,
+                              pool_segment_pt *segments,
+                              unsigned *num_segments) {
+    unsigned num = pool_mgr->pool.num_allocs + pool_mgr->pool.num_gaps;
+    pool_segment_pt seg_list = calloc(num, sizeof(pool_segment_t));
+    if (seg_list == NULL) {
+        return;
+    }
+    unsigned n = 0; // segments started so far
+    for (size_t i = 0; i < pool_mgr->slab_count; i++) {
+        int allocated = ! _mem_slab_is_free(pool_mgr, i);
+        if (allocated || n == 0 || seg_list[n - 1].allocated) {
+            seg_list[n].allocated = (unsigned long) allocated;
+            seg_list[n].size = 0;
+            n++;
+        }
+        seg_list[n - 1].size += pool_mgr->slab_stride;
+    }
+    *num_segments = num;
+    *segments = seg_list;
+}
+
+// pop the free list head; the generation changes with every update
+static alloc_pt _mem_lockfree_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    if (size > pool_mgr->slab_obj_size) {
+        return NULL;
+    }
+    unsigned long long head = __atomic_load_n(&pool_mgr->slab_head, __ATOMIC_ACQUIRE);
+    unsigned long long new_head;
+    unsigned i;
+    do {
+        i = (unsigned) head;
+        if (i == pool_mgr->slab_count) {
+            return NULL;
+        }
+        // may be stale if i was taken meanwhile, but then the swap fails
+        unsigned next = __atomic_load_n(&pool_mgr->slab_next[i], __ATOMIC_RELAXED);
+        new_head = ((head >> 32) + 1) << 32 | next;
+    } while (!__atomic_compare_exchange_n(&pool_mgr->slab_head, &head, new_head, 1,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    alloc_pt record = &pool_mgr->slab_records[i];
+    __atomic_fetch_or(&pool_mgr->slab_map[i / 64], 1ULL << (i % 64), __ATOMIC_RELAXED);
+    record->size = size;
+    __atomic_fetch_add(&pool_mgr->pool.num_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pool_mgr->pool.alloc_size, size, __ATOMIC_RELAXED);
+    return record;
+}
+
+// clearing the object's bit claims the free, so of two frees of the same
+// record only one succeeds
+static alloc_status _mem_lockfree_free(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    if (alloc < pool_mgr->slab_records || alloc >= pool_mgr->slab_records + pool_mgr->slab_count) {
+        return ALLOC_NOT_FREED;
+    }
+    unsigned i = (unsigned) (alloc - pool_mgr->slab_records);
+    unsigned long long bit = 1ULL << (i % 64);
+    if (!(__atomic_fetch_and(&pool_mgr->slab_map[i / 64], ~bit, __ATOMIC_RELAXED) & bit)) {
+        return ALLOC_NOT_FREED;
+    }
+    __atomic_fetch_sub(&pool_mgr->pool.num_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&pool_mgr->pool.alloc_size, alloc->size, __ATOMIC_RELAXED);
+    alloc->size = 0;
+    unsigned long long head = __atomic_load_n(&pool_mgr->slab_head, __ATOMIC_RELAXED);
+    unsigned long long new_head;
+    do {
+        __atomic_store_n(&pool_mgr->slab_next[i], (unsigned) head, __ATOMIC_RELAXED);
+        new_head = ((head >> 32) + 1) << 32 | i;
+    } while (!__atomic_compare_exchange_n(&pool_mgr->slab_head, &head, new_head, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return ALLOC_OK;
+}
+
+// as _mem_slab_inspect, on a snapshot of the map, which also gives the
+// pool its gap count
+static void _mem_lockfree_inspect(pool_mgr_pt pool_mgr,
+                                  pool_segment_pt *segments,
+                                  unsigned *num_segments) {
+    size_t words = (pool_mgr->slab_count + 63) / 64;
+    unsigned long long *map = calloc(words, sizeof(unsigned long long));
+    if (map == NULL) {
+        return;
+    }
+    for (size_t w = 0; w < words; w++) {
+        map[w] = __atomic_load_n(&pool_mgr->slab_map[w], __ATOMIC_RELAXED);
+    }
+    unsigned num = 0, num_gaps = 0;
+    for (size_t i = 0; i < pool_mgr->slab_count; i++) {
+        int allocated = (map[i / 64] >> (i % 64)) & 1;
+        int prev_free = (i > 0) && !((map[(i - 1) / 64] >> ((i - 1) % 64)) & 1);
+        if (allocated || !prev_free) {
+            num++;
+            num_gaps += !allocated;
+        }
+    }
+    pool_segment_pt seg_list = calloc(num, sizeof(pool_segment_t));
+    if (seg_list == NULL) {
+        free(map);
+        return;
+    }
+    unsigned n = 0; // segments started so far
+    for (size_t i = 0; i < pool_mgr->slab_count; i++) {
+        int allocated = (map[i / 64] >> (i % 64)) & 1;
+        if (allocated || n == 0 || seg_list[n - 1].allocated) {
+            seg_list[n].allocated = (unsigned long) allocated;
+            seg_list[n].size = 0;
+            n++;
+        }
+        seg_list[n - 1].size += pool_mgr->slab_stride;
+    }
+    free(map);
+    pool_mgr->pool.num_gaps = num_gaps;
+    *num_segments = num;
+    *segments = seg_list;
+}
+
+static size_t _mem_tag_extent(tag_pt tag) {
+    return tag->extent & ~(size_t) 1;
+}
+
+// write the header and the footer of the segment starting at tag
+static void _mem_tag_set(tag_pt tag, size_t extent, int allocated) {
+    tag->extent = extent | (size_t) allocated;
+    *(size_t *) ((char *) tag + extent - sizeof(size_t)) = tag->extent;
+}
+
+static void _mem_add_to_tag_list(pool_mgr_pt pool_mgr, gap_tag_pt gap) {
+    unsigned k = _mem_seg_class(_mem_tag_extent(&gap->tag));
+    gap->gap_prev = NULL;
+    gap->gap_next = pool_mgr->tag_lists[k];
+    if (gap->gap_next) {
+        gap->gap_next->gap_prev = gap;
+    }
+    pool_mgr->tag_lists[k] = gap;
+    pool_mgr->tag_map |= 1ULL << k;
+}
+
+static void _mem_remove_from_tag_list(pool_mgr_pt pool_mgr, gap_tag_pt gap) {
+    unsigned k = _mem_seg_class(_mem_tag_extent(&gap->tag));
+    if (gap->gap_prev) {
+        gap->gap_prev->gap_next = gap->gap_next;
+    } else {
+        pool_mgr->tag_lists[k] = gap->gap_next;
+        if (gap->gap_next == NULL) {
+            pool_mgr->tag_map &= ~(1ULL << k);
+        }
+    }
+    if (gap->gap_next) {
+        gap->gap_next->gap_prev = gap->gap_prev;
+    }
+}
+
+// one gap over the whole words of the pool (a partial last word is left out)
+static pool_pt _mem_tag_pool_open(mem_ctx_pt ctx, size_t size) {
+    if (ctx->pool_store == NULL) {
+        return NULL;
+    }
+    size -= size % MEM_TAG_ALIGN;
+    if (size < MEM_TAG_MIN_EXTENT) {
+        return NULL;
+    }
+    pool_mgr_pt new_mem_pool_manager = calloc(1, sizeof(pool_mgr_t));
+    if (new_mem_pool_manager == NULL) {
+        return NULL;
     }
-    if(index != -1) {
-        for (int j = index; j < pool_mgr->pool.num_gaps; j++) {
-            pool_mgr->gap_ix[j].node = pool_mgr->gap_ix[j + 1].node;
-            pool_mgr->gap_ix[j].size = pool_mgr->gap_ix[j + 1].size;
+    new_mem_pool_manager->pool.mem = malloc(size);
+    if (new_mem_pool_manager->pool.mem == NULL) {
+        free(new_mem_pool_manager);
+        return NULL;
+    }
+    gap_tag_pt gap = (gap_tag_pt) new_mem_pool_manager->pool.mem;
+    _mem_tag_set(&gap->tag, size, 0);
+    _mem_add_to_tag_list(new_mem_pool_manager, gap);
+    new_mem_pool_manager->pool.policy = TAGGED_FIT;
+    new_mem_pool_manager->pool.total_size = size;
+    new_mem_pool_manager->pool.alloc_size = 0;
+    new_mem_pool_manager->pool.num_allocs = 0;
+    new_mem_pool_manager->pool.num_gaps = 1;
+    if (_mem_add_to_pool_store(ctx, new_mem_pool_manager) != ALLOC_OK) {
+        free(new_mem_pool_manager->pool.mem);
+        free(new_mem_pool_manager);
+        return NULL;
+    }
+
+    return (pool_pt)new_mem_pool_manager;
+}
+
+// segregated fit as in _mem_find_seg_gap, on extents; the rest of the gap
+// stays a gap if it can hold its own tags, otherwise it pads the allocation
+static alloc_pt _mem_tag_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    if (size > pool_mgr->pool.total_size) {
+        return NULL;
+    }
+    size_t extent = sizeof(tag_t)
+                    + (size + MEM_TAG_ALIGN - 1) / MEM_TAG_ALIGN * MEM_TAG_ALIGN
+                    + sizeof(size_t);
+    if (extent < MEM_TAG_MIN_EXTENT) {
+        extent = MEM_TAG_MIN_EXTENT;
+    }
+    unsigned k = _mem_seg_class(extent);
+    gap_tag_pt gap = pool_mgr->tag_lists[k];
+    while (gap != NULL && _mem_tag_extent(&gap->tag) < extent) {
+        gap = gap->gap_next;
+    }
+    if (gap == NULL && k + 1 < MEM_SEG_LIST_CLASSES) {
+        unsigned long long larger = pool_mgr->tag_map & (~0ULL << (k + 1));
+        if (larger != 0) {
+            gap = pool_mgr->tag_lists[__builtin_ctzll(larger)];
         }
+    }
+    if (gap == NULL) {
+        return NULL;
+    }
+    size_t gap_extent = _mem_tag_extent(&gap->tag);
+    _mem_remove_from_tag_list(pool_mgr, gap);
+    if (gap_extent - extent >= MEM_TAG_MIN_EXTENT) {
+        gap_tag_pt rest = (gap_tag_pt) ((char *) gap + extent);
+        _mem_tag_set(&rest->tag, gap_extent - extent, 0);
+        _mem_add_to_tag_list(pool_mgr, rest);
+    } else {
+        extent = gap_extent;
         pool_mgr->pool.num_gaps--;
-        pool_mgr->gap_ix[pool_mgr->pool.num_gaps].node = NULL;
-        pool_mgr->gap_ix[pool_mgr->pool.num_gaps].size = 0;
-        // find the position of the node in the gap index
-        // loop from there to the end of the array:
-        //    pull the entries (i.e. copy over) one position up
-        //    this effectively deletes the chosen node
-        // update metadata (num_gaps)
-        // zero out the element at position num_gaps!
     }
+    tag_pt tag = &gap->tag;
+    _mem_tag_set(tag, extent, 1);
+    tag->alloc_record.size = size;
+    tag->alloc_record.mem = (char *) (tag + 1);
+    pool_mgr->pool.num_allocs++;
+    pool_mgr->pool.alloc_size += size;
+    return &tag->alloc_record;
+}
 
+// check that alloc is the header of a live allocation, then merge the
+// segment with its neighbours, found from its own extent and the footer
+// below it. The tags share pool.mem with the allocations, so a caller
+// that overwrites them can defeat the check, which a node heap pool can't
+static alloc_status _mem_tag_free(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    char *start = pool_mgr->pool.mem;
+    char *end = start + pool_mgr->pool.total_size;
+    char *at = (char *) alloc;
+    if (at < start || at > end - MEM_TAG_MIN_EXTENT || (size_t) (at - start) % MEM_TAG_ALIGN != 0) {
+        return ALLOC_NOT_FREED;
+    }
+    tag_pt tag = (tag_pt) at;
+    size_t extent = _mem_tag_extent(tag);
+    if (!(tag->extent & 1) || tag->alloc_record.mem != (char *) (tag + 1)
+        || extent < MEM_TAG_MIN_EXTENT || extent > (size_t) (end - at)
+        || *(size_t *) (at + extent - sizeof(size_t)) != tag->extent) {
+        return ALLOC_NOT_FREED;
+    }
+    pool_mgr->pool.num_allocs--;
+    pool_mgr->pool.alloc_size -= tag->alloc_record.size;
+    tag->alloc_record.size = 0;
+    tag->alloc_record.mem = NULL;
+
+    // merge the next gap, if any, into the freed segment
+    if (at + extent < end) {
+        tag_pt next = (tag_pt) (at + extent);
+        if (!(next->extent & 1)) {
+            _mem_remove_from_tag_list(pool_mgr, (gap_tag_pt) next);
+            extent += _mem_tag_extent(next);
+            pool_mgr->pool.num_gaps--;
+        }
+    }
+
+    // merge the freed segment into the previous gap, if any
+    if (at > start) {
+        size_t footer = *(size_t *) (at - sizeof(size_t));
+        if (!(footer & 1)) {
+            at -= footer;
+            _mem_remove_from_tag_list(pool_mgr, (gap_tag_pt) at);
+            extent += footer;
+            pool_mgr->pool.num_gaps--;
+        }
+    }
+
+    _mem_tag_set((tag_pt) at, extent, 0);
+    _mem_add_to_tag_list(pool_mgr, (gap_tag_pt) at);
+    pool_mgr->pool.num_gaps++;
     return ALLOC_OK;
 }
 
-// note: only called by _mem_add_to_gap_ix, which appends a single entry
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
-    if(pool_mgr->pool.num_gaps < 2){
-        return ALLOC_OK;
+// one segment per pair of tags, sized by its extent as in BUDDY_FIT
+static void _mem_tag_inspect(pool_mgr_pt pool_mgr,
+                             pool_segment_pt *segments,
+                             unsigned *num_segments) {
+    unsigned num = pool_mgr->pool.num_allocs + pool_mgr->pool.num_gaps;
+    pool_segment_pt seg_list = calloc(num, sizeof(pool_segment_t));
+    if (seg_list == NULL) {
+        return;
+    }
+    pool_segment_pt seg = seg_list;
+    char *end = pool_mgr->pool.mem + pool_mgr->pool.total_size;
+    for (char *at = pool_mgr->pool.mem; at < end; at += seg->size, seg++) {
+        seg->size = _mem_tag_extent((tag_pt) at);
+        seg->allocated = ((tag_pt) at)->extent & 1;
+    }
+    *num_segments = num;
+    *segments = seg_list;
+}
+
+// granules round down, as words do in _mem_tag_pool_open; the bits past
+// the last granule are set in both bitmaps, so no search or scan for the
+// end of a run goes beyond it
+static pool_pt _mem_bitmap_pool_open(mem_ctx_pt ctx, size_t size) {
+    if (ctx->pool_store == NULL) {
+        return NULL;
+    }
+    size_t granules = size / MEM_BITMAP_GRANULE;
+    if (granules == 0) {
+        return NULL;
+    }
+    pool_mgr_pt new_mem_pool_manager = calloc(1, sizeof(pool_mgr_t));
+    if (new_mem_pool_manager == NULL) {
+        return NULL;
+    }
+    size_t words = (granules + 63) / 64;
+    new_mem_pool_manager->pool.mem = malloc(granules * MEM_BITMAP_GRANULE);
+    new_mem_pool_manager->bitmap_used = calloc(words, sizeof(unsigned long long));
+    new_mem_pool_manager->bitmap_starts = calloc(words, sizeof(unsigned long long));
+    if (new_mem_pool_manager->pool.mem == NULL
+        || new_mem_pool_manager->bitmap_used == NULL
+        || new_mem_pool_manager->bitmap_starts == NULL) {
+        free(new_mem_pool_manager->bitmap_starts);
+        free(new_mem_pool_manager->bitmap_used);
+        free(new_mem_pool_manager->pool.mem);
+        free(new_mem_pool_manager);
+        return NULL;
+    }
+    if (granules % 64 != 0) {
+        new_mem_pool_manager->bitmap_used[words - 1] = ~0ULL << (granules % 64);
+        new_mem_pool_manager->bitmap_starts[words - 1] = ~0ULL << (granules % 64);
+    }
+    new_mem_pool_manager->bitmap_granules = granules;
+    new_mem_pool_manager->bitmap_rover = 0;
+    new_mem_pool_manager->pool.policy = BITMAP_FIT;
+    new_mem_pool_manager->pool.total_size = granules * MEM_BITMAP_GRANULE;
+    new_mem_pool_manager->pool.alloc_size = 0;
+    new_mem_pool_manager->pool.num_allocs = 0;
+    new_mem_pool_manager->pool.num_gaps = 1;
+    if (_mem_add_to_pool_store(ctx, new_mem_pool_manager) != ALLOC_OK) {
+        free(new_mem_pool_manager->bitmap_starts);
+        free(new_mem_pool_manager->bitmap_used);
+        free(new_mem_pool_manager->pool.mem);
+        free(new_mem_pool_manager);
+        return NULL;
+    }
+
+    return (pool_pt)new_mem_pool_manager;
+}
+
+static int _mem_bitmap_test(const unsigned long long *map, size_t i) {
+    return (map[i / 64] >> (i % 64)) & 1;
+}
+
+// set or clear the bits of granules [from, to), a word at a time
+static void _mem_bitmap_fill(unsigned long long *map, size_t from, size_t to, int set) {
+    while (from < to) {
+        size_t bits = 64 - from % 64;
+        if (bits > to - from) {
+            bits = to - from;
+        }
+        unsigned long long mask = ((bits == 64) ? ~0ULL : (1ULL << bits) - 1) << (from % 64);
+        if (set) {
+            map[from / 64] |= mask;
+        } else {
+            map[from / 64] &= ~mask;
+        }
+        from += bits;
+    }
+}
+
+// the granule past the end of the allocation or gap that granule i is in,
+// counting from i: the next free granule or start for an allocation, the
+// next used granule for a gap
+static size_t _mem_bitmap_run_end(pool_mgr_pt pool_mgr, size_t i) {
+    int allocated = _mem_bitmap_test(pool_mgr->bitmap_used, i);
+    size_t words = (pool_mgr->bitmap_granules + 63) / 64;
+    for (size_t w = (i + 1) / 64; w < words; w++) {
+        unsigned long long ends = allocated
+                                  ? ~pool_mgr->bitmap_used[w] | pool_mgr->bitmap_starts[w]
+                                  : pool_mgr->bitmap_used[w];
+        if (w == (i + 1) / 64) {
+            ends &= ~0ULL << ((i + 1) % 64);
+        }
+        if (ends != 0) {
+            size_t end = w * 64 + __builtin_ctzll(ends);
+            return (end < pool_mgr->bitmap_granules) ? end : pool_mgr->bitmap_granules;
+        }
+    }
+    return pool_mgr->bitmap_granules;
+}
+
+// first run of count free granules at or after granule from, by whole
+// words where they are all free or all used and by the runs of bits
+// within the others; the granule count if there is none
+static size_t _mem_bitmap_find(pool_mgr_pt pool_mgr, size_t from, size_t count) {
+    size_t words = (pool_mgr->bitmap_granules + 63) / 64;
+    size_t run = 0, start = 0;
+    for (size_t w = from / 64; w < words; w++) {
+        unsigned long long used = pool_mgr->bitmap_used[w];
+        if (w == from / 64) {
+            used |= (1ULL << (from % 64)) - 1; // the granules below from don't count
+        }
+        if (used == ~0ULL) {
+            run = 0;
+            continue;
+        }
+        if (used == 0) {
+            if (run == 0) {
+                start = w * 64;
+            }
+            run += 64;
+            if (run >= count) {
+                return start;
+            }
+            continue;
+        }
+        unsigned bit = 0;
+        while (bit < 64) {
+            unsigned long long rest = used >> bit;
+            if (rest & 1) {
+                bit += (~rest == 0) ? 64 - bit : (unsigned) __builtin_ctzll(~rest);
+                run = 0;
+                continue;
+            }
+            unsigned zeros = (rest == 0) ? 64 - bit : (unsigned) __builtin_ctzll(rest);
+            if (run == 0) {
+                start = w * 64 + bit;
+            }
+            run += zeros;
+            if (run >= count) {
+                return start;
+            }
+            bit += zeros;
+        }
+    }
+    return pool_mgr->bitmap_granules;
+}
+
+// next fit of the record and the size rounded up to whole granules: a
+// first fit from 0 would rescan the full granules at the start of the
+// pool on every call, so the search resumes where the last one ended and
+// only wraps around when it finds nothing there
+static alloc_pt _mem_bitmap_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    if (size > pool_mgr->pool.total_size) {
+        return NULL;
+    }
+    size_t count = 1 + (size + MEM_BITMAP_GRANULE - 1) / MEM_BITMAP_GRANULE;
+    size_t start = pool_mgr->bitmap_granules;
+    if (pool_mgr->bitmap_rover < pool_mgr->bitmap_granules) {
+        start = _mem_bitmap_find(pool_mgr, pool_mgr->bitmap_rover, count);
+    }
+    if (start == pool_mgr->bitmap_granules && pool_mgr->bitmap_rover > 0) {
+        start = _mem_bitmap_find(pool_mgr, 0, count);
+    }
+    if (start == pool_mgr->bitmap_granules) {
+        return NULL;
+    }
+    // the run found leaves what is left of its gap on either side, since
+    // the rover can be inside a gap when the allocation before it is gone
+    size_t end = start + count;
+    pool_mgr->pool.num_gaps--;
+    if (start > 0 && !_mem_bitmap_test(pool_mgr->bitmap_used, start - 1)) {
+        pool_mgr->pool.num_gaps++;
+    }
+    if (end < pool_mgr->bitmap_granules && !_mem_bitmap_test(pool_mgr->bitmap_used, end)) {
+        pool_mgr->pool.num_gaps++;
+    }
+    _mem_bitmap_fill(pool_mgr->bitmap_used, start, end, 1);
+    pool_mgr->bitmap_starts[start / 64] |= 1ULL << (start % 64);
+    pool_mgr->bitmap_rover = end;
+    alloc_pt record = (alloc_pt) (pool_mgr->pool.mem + start * MEM_BITMAP_GRANULE);
+    record->size = size;
+    record->mem = (char *) (record + 1);
+    pool_mgr->pool.num_allocs++;
+    pool_mgr->pool.alloc_size += size;
+    return record;
+}
+
+// check that alloc is the record of a live allocation, then clear its
+// run, whose end is the next free granule or start. As with the tags of
+// TAGGED_FIT, a caller that overwrites the record can defeat the check
+static alloc_status _mem_bitmap_free(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    char *at = (char *) alloc;
+    if (at < pool_mgr->pool.mem || at >= pool_mgr->pool.mem + pool_mgr->pool.total_size
+        || (size_t) (at - pool_mgr->pool.mem) % MEM_BITMAP_GRANULE != 0) {
+        return ALLOC_NOT_FREED;
+    }
+    size_t start = (size_t) (at - pool_mgr->pool.mem) / MEM_BITMAP_GRANULE;
+    if (!_mem_bitmap_test(pool_mgr->bitmap_starts, start) || alloc->mem != (char *) (alloc + 1)) {
+        return ALLOC_NOT_FREED;
+    }
+    size_t end = _mem_bitmap_run_end(pool_mgr, start);
+    pool_mgr->bitmap_starts[start / 64] &= ~(1ULL << (start % 64));
+    _mem_bitmap_fill(pool_mgr->bitmap_used, start, end, 0);
+
+    // the freed run joins a gap on either side
+    pool_mgr->pool.num_gaps++;
+    if (start > 0 && !_mem_bitmap_test(pool_mgr->bitmap_used, start - 1)) {
+        pool_mgr->pool.num_gaps--;
+    }
+    if (end < pool_mgr->bitmap_granules && !_mem_bitmap_test(pool_mgr->bitmap_used, end)) {
+        pool_mgr->pool.num_gaps--;
+    }
+    pool_mgr->pool.num_allocs--;
+    pool_mgr->pool.alloc_size -= alloc->size;
+    alloc->size = 0;
+    alloc->mem = NULL;
+    return ALLOC_OK;
+}
+
+// one segment per allocation, record included, and one per free run
+static void _mem_bitmap_inspect(pool_mgr_pt pool_mgr,
+                                pool_segment_pt *segments,
+                                unsigned *num_segments) {
+    unsigned num = pool_mgr->pool.num_allocs + pool_mgr->pool.num_gaps;
+    pool_segment_pt seg_list = calloc(num, sizeof(pool_segment_t));
+    if (seg_list == NULL) {
+        return;
+    }
+    pool_segment_pt seg = seg_list;
+    for (size_t i = 0; i < pool_mgr->bitmap_granules; seg++) {
+        size_t end = _mem_bitmap_run_end(pool_mgr, i);
+        seg->size = (end - i) * MEM_BITMAP_GRANULE;
+        seg->allocated = _mem_bitmap_test(pool_mgr->bitmap_used, i);
+        i = end;
+    }
+    *num_segments = num;
+    *segments = seg_list;
+}
+
+// the shard of the CPU the thread runs on, or else the thread's own
+static unsigned _mem_shard_index(unsigned num_shards) {
+#ifdef MEM_POOL_THREADS
+    static unsigned next_thread = 0;
+    static _Thread_local unsigned thread_shard = 0; // 1 + the thread's number, 0 until it has one
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0) {
+        return (unsigned) cpu % num_shards;
+    }
+#endif
+    if (thread_shard == 0) {
+        thread_shard = 1 + __atomic_fetch_add(&next_thread, 1, __ATOMIC_RELAXED);
+    }
+    return (thread_shard - 1) % num_shards;
+#else
+    (void) num_shards;
+    return 0;
+#endif
+}
+
+// the shard whose memory holds mem, NULL if none
+static pool_pt _mem_shard_of(sharded_pool_mgr_pt sharded_mgr, const char *mem) {
+    unsigned lo = 0, hi = sharded_mgr->pool.num_shards;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (sharded_mgr->by_address[mid]->mem <= mem) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return NULL;
+    }
+    pool_pt shard = sharded_mgr->by_address[lo - 1];
+    return (mem < shard->mem + shard->total_size) ? shard : NULL;
+}
+
+#ifdef MEM_POOL_THREADS
+static void _mem_tcache_make_key() {
+    pthread_key_create(&tcache_key, _mem_tcache_destroy);
+}
+
+// runs at thread exit, so a thread's blocks outlive it only until then
+static void _mem_tcache_destroy(void *tcache_set) {
+    tcache_set_pt set = (tcache_set_pt) tcache_set;
+    MEM_LOCK(&tcache_sets_lock);
+    for (unsigned u = 0; u < MEM_TCACHE_POOLS; u++) {
+        _mem_tcache_flush(&set->entries[u]);
+    }
+    if (set->prev) {
+        set->prev->next = set->next;
+    } else {
+        tcache_sets = set->next;
+    }
+    if (set->next) {
+        set->next->prev = set->prev;
+    }
+    MEM_UNLOCK(&tcache_sets_lock);
+    free(set);
+}
+
+// the calling thread's entry for the pool; if create, a missing entry
+// takes an unused one, or the next in turn is flushed to make room
+static tcache_pt _mem_tcache_find(pool_mgr_pt pool_mgr, int create) {
+    static _Thread_local unsigned next_victim = 0;
+    tcache_set_pt set = pthread_getspecific(tcache_key);
+    if (set == NULL) {
+        if (!create) {
+            return NULL;
+        }
+        set = calloc(1, sizeof(tcache_set_t));
+        if (set == NULL) {
+            return NULL;
+        }
+        if (pthread_setspecific(tcache_key, set) != 0) {
+            free(set);
+            return NULL;
+        }
+        MEM_LOCK(&tcache_sets_lock);
+        set->next = tcache_sets;
+        if (tcache_sets) {
+            tcache_sets->prev = set;
+        }
+        tcache_sets = set;
+        MEM_UNLOCK(&tcache_sets_lock);
+    }
+    tcache_pt tcaches = set->entries;
+    tcache_pt unused = NULL;
+    // a close may unbind an entry from another thread, see _mem_tcache_unbind
+    for (unsigned u = 0; u < MEM_TCACHE_POOLS; u++) {
+        pool_mgr_pt bound = __atomic_load_n(&tcaches[u].pool_mgr, __ATOMIC_RELAXED);
+        if (bound == pool_mgr) {
+            return &tcaches[u];
+        }
+        if (unused == NULL && bound == NULL) {
+            unused = &tcaches[u];
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    if (unused == NULL) {
+        unused = &tcaches[next_victim];
+        next_victim = (next_victim + 1) % MEM_TCACHE_POOLS;
+        MEM_LOCK(&tcache_sets_lock);
+        _mem_tcache_flush(unused);
+        MEM_UNLOCK(&tcache_sets_lock);
+    }
+    // an entry unbound by a close keeps the counts of its old pool
+    unused->hits = 0;
+    unused->misses = 0;
+    __atomic_store_n(&unused->pool_mgr, pool_mgr, __ATOMIC_RELAXED);
+    return unused;
+}
+
+// gives all the blocks back and adds up the counters; called with
+// tcache_sets_lock held, and a no-op on an unused entry
+static void _mem_tcache_flush(tcache_pt tcache) {
+    pool_mgr_pt pool_mgr = __atomic_load_n(&tcache->pool_mgr, __ATOMIC_RELAXED);
+    if (pool_mgr == NULL) {
+        return;
+    }
+    MEM_LOCK(&pool_mgr->lock);
+    for (unsigned k = 0; k < MEM_TCACHE_CLASSES; k++) {
+        while (tcache->counts[k] > 0) {
+            _mem_tcache_release(pool_mgr, tcache->blocks[k][--tcache->counts[k]]);
+        }
+    }
+    pool_mgr->tcache_hits += tcache->hits;
+    pool_mgr->tcache_misses += tcache->misses;
+    MEM_UNLOCK(&pool_mgr->lock);
+    tcache->hits = 0;
+    tcache->misses = 0;
+    __atomic_store_n(&tcache->pool_mgr, NULL, __ATOMIC_RELAXED);
+}
+
+// called by mem_pool_close on a pool it is about to free: the entries
+// that other threads still have for it hold no blocks, since the pool
+// has no allocations, but would be flushed into it on their exit
+static void _mem_tcache_unbind(pool_mgr_pt pool_mgr) {
+    MEM_LOCK(&tcache_sets_lock);
+    for (tcache_set_pt set = tcache_sets; set != NULL; set = set->next) {
+        for (unsigned u = 0; u < MEM_TCACHE_POOLS; u++) {
+            if (__atomic_load_n(&set->entries[u].pool_mgr, __ATOMIC_RELAXED) == pool_mgr) {
+                __atomic_store_n(&set->entries[u].pool_mgr, NULL, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    MEM_UNLOCK(&tcache_sets_lock);
+}
+
+// a hit pops the class stack; a miss refills it with a batch of blocks
+static alloc_pt _mem_tcache_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    unsigned k = (unsigned) ((size - 1) / MEM_TCACHE_GRANULE);
+    size_t block_size = (k + 1) * MEM_TCACHE_GRANULE;
+    tcache_pt tcache = _mem_tcache_find(pool_mgr, 1);
+    if (tcache == NULL) {
+        MEM_LOCK(&pool_mgr->lock);
+        alloc_pt alloc = _mem_new_alloc((pool_pt) pool_mgr, block_size);
+        MEM_UNLOCK(&pool_mgr->lock);
+        return alloc;
+    }
+    if (tcache->counts[k] > 0) {
+        tcache->hits++;
+        alloc_pt alloc = tcache->blocks[k][--tcache->counts[k]];
+        __atomic_store_n(&((node_pt) alloc)->gap_slot, MEM_NODE_LIVE, __ATOMIC_RELAXED);
+        return alloc;
+    }
+    tcache->misses++;
+    MEM_LOCK(&pool_mgr->lock);
+    pool_mgr->tcache_hits += tcache->hits;
+    pool_mgr->tcache_misses += tcache->misses;
+    tcache->hits = 0;
+    tcache->misses = 0;
+    alloc_pt alloc = _mem_new_alloc((pool_pt) pool_mgr, block_size);
+    while (alloc != NULL && tcache->counts[k] < MEM_TCACHE_BATCH - 1) {
+        alloc_pt extra = _mem_new_alloc((pool_pt) pool_mgr, block_size);
+        if (extra == NULL) {
+            break;
+        }
+        __atomic_store_n(&((node_pt) extra)->gap_slot, MEM_NODE_CACHED, __ATOMIC_RELAXED);
+        tcache->blocks[k][tcache->counts[k]++] = extra;
+    }
+    MEM_UNLOCK(&pool_mgr->lock);
+    return alloc;
+}
+
+// claiming the block's mark makes a second free of it fail, as the pool
+// would; note: alloc is one of the pool's nodes, see mem_del_alloc
+static alloc_status _mem_tcache_free(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    unsigned k = (unsigned) ((alloc->size - 1) / MEM_TCACHE_GRANULE);
+    unsigned live = MEM_NODE_LIVE;
+    if (!__atomic_compare_exchange_n(&((node_pt) alloc)->gap_slot, &live, MEM_NODE_CACHED, 0,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return ALLOC_NOT_FREED;
+    }
+    tcache_pt tcache = _mem_tcache_find(pool_mgr, 1);
+    if (tcache == NULL) {
+        MEM_LOCK(&pool_mgr->lock);
+        alloc_status status = _mem_tcache_release(pool_mgr, alloc);
+        MEM_UNLOCK(&pool_mgr->lock);
+        return status;
+    }
+    if (tcache->counts[k] == MEM_TCACHE_DEPTH) {
+        // the oldest blocks go back, the recently used stay
+        MEM_LOCK(&pool_mgr->lock);
+        for (unsigned u = 0; u < MEM_TCACHE_BATCH; u++) {
+            _mem_tcache_release(pool_mgr, tcache->blocks[k][u]);
+        }
+        MEM_UNLOCK(&pool_mgr->lock);
+        tcache->counts[k] -= MEM_TCACHE_BATCH;
+        memmove(tcache->blocks[k], tcache->blocks[k] + MEM_TCACHE_BATCH, tcache->counts[k] * sizeof(alloc_pt));
     }
-    int count = pool_mgr->pool.num_gaps - 1;
-    gap_t gap1 = pool_mgr->gap_ix[count];
-    gap_t gap2 = pool_mgr->gap_ix[count-1];
-    for(int i = count; i > 0; i--){
-        if (gap1.size < gap2.size
-            || (gap1.size == gap2.size
-                && gap1.node->alloc_record.mem < gap2.node->alloc_record.mem)) {
-            gap_t temp = gap1;
-            gap1 = gap2;
-            gap2 = temp;
-        }
-    }
-    // the new entry is at the end, so "bubble it up"
-    // loop from num_gaps - 1 until but not including 0:
-    //    if the size of the current entry is less than the previous (u - 1)
-    //    or if the sizes are the same but the current entry points to a
-    //    node with a lower address of pool allocation address (mem)
-    //       swap them (by copying) (remember to use a temporary variable)
+    tcache->blocks[k][tcache->counts[k]++] = alloc;
+    return ALLOC_OK;
+}
+
+// give a cached block back to the pool, with the pool's lock held
+static alloc_status _mem_tcache_release(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    __atomic_store_n(&((node_pt) alloc)->gap_slot, MEM_NODE_LIVE, __ATOMIC_RELAXED);
+    return _mem_del_alloc((pool_pt) pool_mgr, alloc);
+}
 
+// a Treiber push; the drain takes the whole stack at once, so there is no
+// pop to suffer from ABA; claiming the block's mark first makes a second
+// free of it fail rather than link it twice
+// note: alloc is one of the pool's nodes, see mem_del_alloc
+static alloc_status _mem_remote_push(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    if (alloc->mem < pool_mgr->pool.mem
+        || alloc->mem + sizeof(alloc_pt) > pool_mgr->pool.mem + pool_mgr->pool.total_size) {
+        return ALLOC_NOT_FREED;
+    }
+    unsigned live = MEM_NODE_LIVE;
+    if (!__atomic_compare_exchange_n(&((node_pt) alloc)->gap_slot, &live, MEM_NODE_QUEUED, 0,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return ALLOC_NOT_FREED;
+    }
+    alloc_pt head = __atomic_load_n(&pool_mgr->remote_frees, __ATOMIC_RELAXED);
+    do {
+        memcpy(alloc->mem, &head, sizeof(alloc_pt)); // alloc->mem may be unaligned
+    } while (!__atomic_compare_exchange_n(&pool_mgr->remote_frees, &head, alloc, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
     return ALLOC_OK;
 }
 
+// called with the pool's lock held, or by mem_pool_close
+static void _mem_remote_drain(pool_mgr_pt pool_mgr) {
+    if (__atomic_load_n(&pool_mgr->remote_frees, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    alloc_pt alloc = __atomic_exchange_n(&pool_mgr->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    while (alloc != NULL) {
+        alloc_pt next;
+        memcpy(&next, alloc->mem, sizeof(alloc_pt));
+        // checked again, now against the allocation map
+        if (_mem_alloc_map_find(pool_mgr, alloc->mem) == (node_pt) alloc) {
+            __atomic_store_n(&((node_pt) alloc)->gap_slot, MEM_NODE_LIVE, __ATOMIC_RELAXED);
+            _mem_del_alloc((pool_pt) pool_mgr, alloc);
+        }
+        alloc = next;
+    }
+}
 
+// Fibonacci hashing of the chunk's number, as the allocation map does offsets
+static unsigned _mem_chunk_set_home(chunk_set_pt set, node_pt chunk) {
+    unsigned long long number = (unsigned long long) ((uintptr_t) chunk / MEM_NODE_CHUNK_BYTES);
+    return (unsigned) ((number * 0x9E3779B97F4A7C15ULL) >> 32) & (set->capacity - 1);
+}
 
+// called with the pool's lock held, or by mem_ctx_pool_open
+static alloc_status _mem_chunk_set_add(pool_mgr_pt pool_mgr, node_pt chunk) {
+    chunk_set_pt set = pool_mgr->chunk_set;
+    // kept at most half full, as the allocation map is
+    if (set == NULL || 2 * (pool_mgr->node_heap_chunks + 1) > set->capacity) {
+        unsigned capacity = (set != NULL) ? set->capacity * MEM_CHUNK_SET_EXPAND_FACTOR : MEM_CHUNK_SET_INIT_CAPACITY;
+        chunk_set_pt grown = calloc(1, sizeof(chunk_set_t) + capacity * sizeof(node_pt));
+        if (grown == NULL) {
+            return ALLOC_FAIL;
+        }
+        grown->outgrown = set;
+        grown->capacity = capacity;
+        for (unsigned c = 0; c < pool_mgr->node_heap_chunks; c++) {
+            unsigned u = _mem_chunk_set_home(grown, pool_mgr->node_heap[c]);
+            while (grown->chunks[u] != NULL) {
+                u = (u + 1) & (capacity - 1);
+            }
+            grown->chunks[u] = pool_mgr->node_heap[c];
+        }
+        __atomic_store_n(&pool_mgr->chunk_set, grown, __ATOMIC_RELEASE);
+        set = grown;
+    }
+    unsigned u = _mem_chunk_set_home(set, chunk);
+    while (set->chunks[u] != NULL) {
+        u = (u + 1) & (set->capacity - 1);
+    }
+    __atomic_store_n(&set->chunks[u], chunk, __ATOMIC_RELEASE);
+    return ALLOC_OK;
+}
 
+// whether alloc is one of the pool's nodes, found from its address alone,
+// so that a copy of a record or another pool's record is never marked
+// note: the pool's lock need not be held
+static int _mem_owns_node(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    uintptr_t offset = (uintptr_t) alloc % MEM_NODE_CHUNK_BYTES;
+    if (offset % sizeof(node_t) != 0) {
+        return 0;
+    }
+    node_pt chunk = (node_pt) ((uintptr_t) alloc - offset);
+    chunk_set_pt set = __atomic_load_n(&pool_mgr->chunk_set, __ATOMIC_ACQUIRE);
+    for (unsigned u = _mem_chunk_set_home(set, chunk); ; u = (u + 1) & (set->capacity - 1)) {
+        node_pt entry = __atomic_load_n(&set->chunks[u], __ATOMIC_ACQUIRE);
+        if (entry == NULL) {
+            return 0;
+        }
+        if (entry == chunk) {
+            return 1;
+        }
+    }
+}
+#endif
@@ -9,7 +9,19 @@
 
 /* type declarations */
 
-typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
+typedef enum _alloc_policy {
+    FIRST_FIT,
+    BEST_FIT,
+    SEGREGATED_FIT,
+    TLSF_FIT,
+    BUDDY_FIT,
+    NEXT_FIT,
+    WORST_FIT,
+    SLAB_FIT, // fixed-size objects, see mem_pool_open_slab
+    TAGGED_FIT, // segregated fit with in-band boundary tags instead of a node heap
+    BITMAP_FIT, // next fit on a bitmap of 16-byte granules, for many small allocations
+    LOCKFREE_SLAB_FIT // SLAB_FIT with lock-free alloc and free, see mem_pool_open_lockfree
+} alloc_policy;
 
 typedef struct _pool {
     char *mem;
@@ -30,6 +42,15 @@ typedef struct _pool_segment {
     unsigned long allocated; // 1-allocation, 0-gap (note: 8 bytes)
 } pool_segment_t, *pool_segment_pt;
 
+// one ordinary pool per CPU, see mem_sharded_pool_open
+typedef struct _sharded_pool {
+    unsigned num_shards;
+    pool_pt *shards;
+} sharded_pool_t, *sharded_pool_pt;
+
+// an independent pool store, see mem_ctx_create
+typedef struct _mem_ctx mem_ctx_t, *mem_ctx_pt;
+
 typedef enum _alloc_status {
     ALLOC_OK,
     ALLOC_FAIL,
@@ -39,15 +60,51 @@ typedef enum _alloc_status {
 
 /* function declarations */
 
+// built with MEM_POOL_THREADS, pools may be opened, used and closed from
+// any thread; calls on one pool are serialised, calls on different pools
+// run in parallel; a pool must not be closed while in use, and mem_init
+// and mem_free must not race with anything
+
 alloc_status
 mem_init();
 
 alloc_status
 mem_free();
 
+// a context of its own, for a subsystem that opens and closes pools apart
+// from the rest of the process; mem_init and mem_free manage the default
+// context, which the calls without a context use
+mem_ctx_pt
+mem_ctx_create();
+
+// closes the context's pools, as mem_free does; a pool still holding
+// allocations outlives the context and can be closed once empty
+alloc_status
+mem_ctx_destroy(mem_ctx_pt ctx);
+
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+// the pool calls need no context, each pool knows its own
+pool_pt
+mem_ctx_pool_open(mem_ctx_pt ctx, size_t size, alloc_policy policy);
+
+// a SLAB_FIT pool of count objects of obj_size bytes each
+pool_pt
+mem_pool_open_slab(size_t obj_size, size_t count);
+
+pool_pt
+mem_ctx_pool_open_slab(mem_ctx_pt ctx, size_t obj_size, size_t count);
+
+// a LOCKFREE_SLAB_FIT pool of count objects of obj_size bytes each, which
+// any number of threads may use without a lock; its num_gaps is counted
+// only by mem_inspect_pool
+pool_pt
+mem_pool_open_lockfree(size_t obj_size, size_t count);
+
+pool_pt
+mem_ctx_pool_open_lockfree(mem_ctx_pt ctx, size_t obj_size, size_t count);
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
@@ -57,7 +114,66 @@ mem_new_alloc(pool_pt pool, size_t size);
 alloc_status
 mem_del_alloc(pool_pt pool, alloc_pt alloc);
 
+// the address of a new allocation of size > 0 bytes inside pool->mem,
+// for callers that track allocations by address rather than by record
+char *
+mem_new_alloc_addr(pool_pt pool, size_t size);
+
+alloc_status
+mem_del_alloc_addr(pool_pt pool, char *mem);
+
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 
+// BUDDY_FIT only: number of free blocks of each order (block size 2^order)
+void
+mem_inspect_buddy(pool_pt pool, unsigned **free_blocks, unsigned *num_orders);
+
+// num_shards pools of shard_size bytes each, or one per CPU if 0; with
+// MEM_POOL_THREADS a thread allocates in the shard of the CPU it runs on,
+// and in the others only when that one is full
+sharded_pool_pt
+mem_sharded_pool_open(size_t shard_size, alloc_policy policy, unsigned num_shards);
+
+sharded_pool_pt
+mem_ctx_sharded_pool_open(mem_ctx_pt ctx, size_t shard_size, alloc_policy policy, unsigned num_shards);
+
+alloc_status
+mem_sharded_pool_close(sharded_pool_pt pool);
+
+alloc_pt
+mem_sharded_new_alloc(sharded_pool_pt pool, size_t size);
+
+// an allocation goes back to the shard that holds it, from any thread
+alloc_status
+mem_sharded_del_alloc(sharded_pool_pt pool, alloc_pt alloc);
+
+// totals: the sums of the shards' sizes and counts
+void
+mem_inspect_sharded_pool(sharded_pool_pt pool, pool_pt totals);
+
+// MEM_POOL_THREADS only: make the calling thread the pool's owner; frees
+// of at least a pointer's size from other threads then go onto a
+// lock-free queue, which the next allocation empties in one batch; fails
+// on SLAB_FIT, LOCKFREE_SLAB_FIT, TAGGED_FIT and BITMAP_FIT pools, and
+// returns ALLOC_CALLED_AGAIN if the pool already has an owner
+alloc_status
+mem_pool_set_owner(pool_pt pool);
+
+// MEM_POOL_THREADS only: serve requests of up to 256 bytes from per-thread
+// caches of free blocks, rounded up to a multiple of 16 bytes; cached
+// blocks count as allocated until the thread flushes or exits; fails on
+// SLAB_FIT, LOCKFREE_SLAB_FIT, TAGGED_FIT and BITMAP_FIT pools
+alloc_status
+mem_pool_enable_tcache(pool_pt pool);
+
+// return the calling thread's cached blocks to their pools
+void
+mem_tcache_flush();
+
+// allocations served from and missed by the caches, as of each thread's
+// last refill or flush
+void
+mem_inspect_tcache(pool_pt pool, unsigned long *hits, unsigned long *misses);
+
 #endif //DENVER_OS_PA_C_MEM_POOL_H
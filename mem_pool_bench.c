@@ -0,0 +1,1035 @@
+/*
+ * Micro-benchmarks for the memory pool.
+ *
+ * The pool translation unit is included directly so that the benchmarks
+ * can drive the static index routines and read the manager internals.
+ */
+
+#define _GNU_SOURCE // for sched_getcpu() in the pool
+#define MEM_POOL_STATS
+#define MEM_POOL_THREADS
+
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mem_pool.c"
+
+
+/*****            constants            *****/
+
+static const unsigned BENCH_DEFAULT_MAX_GAPS = 1000000;
+static const unsigned BENCH_GAP_IX_OPS       = 1000000;
+static const unsigned BENCH_FREE_PATH_GAPS   = 50000;
+static const unsigned BENCH_FREE_PATH_BATCH  = 1000;
+static const unsigned BENCH_NODE_HEAP_OPS    = 10000;
+static const unsigned BENCH_LAYOUT_SEGMENTS  = 1000000;
+static const size_t   BENCH_CACHE_LINE       = 64;
+static const unsigned BENCH_SCAN_ENTRIES     = 100000000;
+static const unsigned BENCH_POOL_CYCLES      = 1000000;
+static const unsigned BENCH_THREAD_OPS       = 1000000;
+static const unsigned BENCH_MAX_THREADS      = 64;
+
+#define BENCH_THREAD_LIVE 256
+#define BENCH_RING_SLOTS  1024
+
+
+/*****         helper routines         *****/
+
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// xorshift, so that runs are repeatable across libcs
+static unsigned long bench_rand_state = 88172645463325252UL;
+
+static unsigned long bench_rand() {
+    bench_rand_state ^= bench_rand_state << 13;
+    bench_rand_state ^= bench_rand_state >> 7;
+    bench_rand_state ^= bench_rand_state << 17;
+    return bench_rand_state;
+}
+
+// allocated nodes of a pool in address order, NULL-terminated
+static node_pt *bench_allocated_nodes(pool_mgr_pt mgr) {
+    node_pt *nodes = calloc(mgr->pool.num_allocs + 1, sizeof(node_pt));
+    unsigned n = 0;
+    if (nodes == NULL) {
+        return NULL;
+    }
+    for (unsigned ix = MEM_NODE_HEAD; ix != 0; ix = _mem_node(mgr, ix)->next) {
+        if (_mem_node(mgr, ix)->allocated) {
+            nodes[n++] = _mem_node(mgr, ix);
+        }
+    }
+    return nodes;
+}
+
+// num_gaps gaps of random size indexed in an emptied pool, on nodes taken
+// from its node heap; their addresses are distinct, so the keys are unique
+static unsigned *bench_stand_in_gaps(pool_mgr_pt mgr, unsigned num_gaps) {
+    unsigned *nodes = calloc(num_gaps, sizeof(unsigned));
+    if (nodes == NULL || _mem_resize_node_heap(mgr, num_gaps) != ALLOC_OK) {
+        free(nodes);
+        return NULL;
+    }
+    for (unsigned u = 0; u < num_gaps; u++) {
+        nodes[u] = _mem_acquire_node(mgr);
+        node_pt node = _mem_node(mgr, nodes[u]);
+        node->alloc_record.mem = (char *) node;
+        node->alloc_record.size = 1 + bench_rand() % 4096;
+        _mem_add_to_gap_ix(mgr, node->alloc_record.size, nodes[u]);
+    }
+    return nodes;
+}
+
+
+/*******************************************/
+/***            1. GAP INDEX             ***/
+/*******************************************/
+
+/*
+ * Fills the gap index of a FIRST_FIT or BEST_FIT pool with num_gaps gaps
+ * of random size and then times the cycle of mem_new_alloc/mem_del_alloc:
+ * look up a fitting gap, remove it, and re-insert the remainder.
+ */
+static void bench_gap_ix(alloc_policy policy, unsigned num_gaps) {
+    unsigned (*find)(pool_mgr_pt, size_t) =
+            (policy == FIRST_FIT) ? _mem_find_first_gap : _mem_find_best_gap;
+    pool_mgr_pt mgr = (pool_mgr_pt) mem_pool_open(1, policy);
+    if (mgr == NULL) {
+        return;
+    }
+    _mem_remove_from_gap_ix(mgr, _mem_node(mgr, MEM_NODE_HEAD)->alloc_record.size, MEM_NODE_HEAD);
+
+    unsigned *nodes = bench_stand_in_gaps(mgr, num_gaps);
+    if (nodes == NULL) {
+        mem_pool_close((pool_pt) mgr);
+        return;
+    }
+
+    double start = bench_now();
+    for (unsigned op = 0; op < BENCH_GAP_IX_OPS; op++) {
+        size_t size = 1 + bench_rand() % 4096;
+        unsigned ix = find(mgr, size);
+        if (ix == 0) {
+            ix = find(mgr, 0); // nothing fits, recycle any gap
+        }
+        node_pt node = _mem_node(mgr, ix);
+        _mem_remove_from_gap_ix(mgr, node->alloc_record.size, ix);
+        node->alloc_record.size = 1 + bench_rand() % 4096;
+        _mem_add_to_gap_ix(mgr, node->alloc_record.size, ix);
+    }
+    double elapsed = bench_now() - start;
+
+    printf("%10u gaps: %8.1f ns per find/remove/insert\n",
+           num_gaps, elapsed * 1e9 / BENCH_GAP_IX_OPS);
+
+    while (mgr->gap_ix_root) {
+        gap_pt gap = &mgr->gap_ix[mgr->gap_ix_root];
+        _mem_remove_from_gap_ix(mgr, gap->size, gap->node);
+    }
+    for (unsigned u = 0; u < num_gaps; u++) {
+        _mem_release_node(mgr, nodes[u]);
+    }
+    free(nodes);
+    _mem_add_to_gap_ix(mgr, _mem_node(mgr, MEM_NODE_HEAD)->alloc_record.size, MEM_NODE_HEAD);
+    mem_pool_close((pool_pt) mgr);
+}
+
+
+/*
+ * Fills the gap index of a pool with num_gaps gaps and then times the
+ * index work of a coalescing mem_del_alloc: a neighbouring gap is taken
+ * out of the index and put back with the merged size. Removals and
+ * insertions are timed apart, in batches of distinct gaps.
+ */
+static void bench_gap_free(alloc_policy policy, const char *name, unsigned num_gaps) {
+    pool_mgr_pt mgr = (pool_mgr_pt) mem_pool_open(1, policy);
+    if (mgr == NULL) {
+        return;
+    }
+    _mem_remove_from_gap_ix(mgr, _mem_node(mgr, MEM_NODE_HEAD)->alloc_record.size, MEM_NODE_HEAD);
+
+    unsigned *nodes = bench_stand_in_gaps(mgr, num_gaps);
+    if (nodes == NULL) {
+        mem_pool_close((pool_pt) mgr);
+        return;
+    }
+
+    // a prime stride visits distinct gaps within a batch
+    const unsigned stride = 7919;
+    double remove_time = 0, insert_time = 0;
+    for (unsigned op = 0; op < BENCH_GAP_IX_OPS; op += BENCH_FREE_PATH_BATCH) {
+        unsigned base = (unsigned) (bench_rand() % num_gaps);
+        double start = bench_now();
+        for (unsigned k = 0; k < BENCH_FREE_PATH_BATCH; k++) {
+            unsigned ix = nodes[(base + k * stride) % num_gaps];
+            _mem_remove_from_gap_ix(mgr, _mem_node(mgr, ix)->alloc_record.size, ix);
+        }
+        double middle = bench_now();
+        for (unsigned k = 0; k < BENCH_FREE_PATH_BATCH; k++) {
+            unsigned ix = nodes[(base + k * stride) % num_gaps];
+            _mem_node(mgr, ix)->alloc_record.size = 1 + (base + k) % 4096;
+            _mem_add_to_gap_ix(mgr, _mem_node(mgr, ix)->alloc_record.size, ix);
+        }
+        remove_time += middle - start;
+        insert_time += bench_now() - middle;
+    }
+
+    printf("%10s: %8.1f ns per remove, %8.1f ns per insert at %u gaps\n",
+           name, remove_time * 1e9 / BENCH_GAP_IX_OPS,
+           insert_time * 1e9 / BENCH_GAP_IX_OPS, num_gaps);
+
+    for (unsigned u = 0; u < num_gaps; u++) {
+        _mem_remove_from_gap_ix(mgr, _mem_node(mgr, nodes[u])->alloc_record.size, nodes[u]);
+        _mem_release_node(mgr, nodes[u]);
+    }
+    free(nodes);
+    _mem_add_to_gap_ix(mgr, _mem_node(mgr, MEM_NODE_HEAD)->alloc_record.size, MEM_NODE_HEAD);
+    mem_pool_close((pool_pt) mgr);
+}
+
+
+/*******************************************/
+/***            2. NODE HEAP             ***/
+/*******************************************/
+
+/*
+ * Fills a FIRST_FIT pool with num_allocs small allocations, which grows
+ * the node heap to match, recording the slowest allocation that grew it
+ * (and nothing else), and then times further allocations, each of which
+ * splits the trailing gap and so takes an unused node, and their frees in
+ * reverse order, each of which looks the node up in the allocation map.
+ */
+static void bench_node_heap(unsigned num_allocs) {
+    const size_t alloc_size = 16;
+    pool_mgr_pt mgr = (pool_mgr_pt) mem_pool_open((num_allocs + BENCH_NODE_HEAP_OPS + 1) * alloc_size,
+                                                  FIRST_FIT);
+    if (mgr == NULL) {
+        return;
+    }
+    alloc_pt *allocs = calloc(num_allocs + BENCH_NODE_HEAP_OPS, sizeof(alloc_pt));
+    if (allocs == NULL) {
+        mem_pool_close((pool_pt) mgr);
+        return;
+    }
+    double worst = 0;
+    for (unsigned aix = 0; aix < num_allocs; ++aix) {
+        unsigned total_nodes = mgr->total_nodes;
+        unsigned alloc_map_capacity = mgr->alloc_map_capacity;
+        double start = bench_now();
+        allocs[aix] = mem_new_alloc((pool_pt) mgr, alloc_size);
+        double elapsed = bench_now() - start;
+        if (mgr->total_nodes != total_nodes
+            && mgr->alloc_map_capacity == alloc_map_capacity
+            && elapsed > worst) {
+            worst = elapsed;
+        }
+    }
+
+    double start = bench_now();
+    for (unsigned op = 0; op < BENCH_NODE_HEAP_OPS; op++) {
+        allocs[num_allocs + op] = mem_new_alloc((pool_pt) mgr, alloc_size);
+    }
+    double alloc_time = bench_now() - start;
+
+    start = bench_now();
+    for (unsigned op = BENCH_NODE_HEAP_OPS; op > 0; op--) {
+        mem_del_alloc((pool_pt) mgr, allocs[num_allocs + op - 1]);
+    }
+    double free_time = bench_now() - start;
+
+    printf("%10u nodes: %8.1f ns per alloc, %8.1f ns per free, slowest growth %10.1f us\n",
+           mgr->total_nodes, alloc_time * 1e9 / BENCH_NODE_HEAP_OPS,
+           free_time * 1e9 / BENCH_NODE_HEAP_OPS, worst * 1e6);
+
+    for (unsigned aix = num_allocs; aix > 0; aix--) {
+        mem_del_alloc((pool_pt) mgr, allocs[aix - 1]);
+    }
+    free(allocs);
+    mem_pool_close((pool_pt) mgr);
+}
+
+
+// the pointer-linked node layout that index links replaced, to size it
+typedef struct _wide_node {
+    alloc_t alloc_record;
+    unsigned used;
+    unsigned allocated;
+    struct _wide_node *next, *prev;
+    struct _wide_node *gap_next, *gap_prev;
+    unsigned gap_slot;
+} wide_node_t;
+
+static void bench_layout_line(const char *name, size_t node_size, size_t bytes, unsigned num_segments) {
+    printf("%10s: %3lu bytes per node, %lu per cache line, %7.1f MiB, %6.1f bytes per segment\n",
+           name, (unsigned long) node_size, (unsigned long) (BENCH_CACHE_LINE / node_size),
+           bytes / 1048576.0, (double) bytes / num_segments);
+}
+
+/*
+ * Fills a pool with num_segments allocations and reports the memory held
+ * by its node heap and allocation map, next to what the same heap and map
+ * would hold with pointer links.
+ */
+static void bench_node_layout(unsigned num_segments) {
+    const size_t alloc_size = 16;
+    pool_mgr_pt mgr = (pool_mgr_pt) mem_pool_open(num_segments * alloc_size, FIRST_FIT);
+    alloc_pt *allocs = calloc(num_segments, sizeof(alloc_pt));
+    if (mgr == NULL || allocs == NULL) {
+        free(allocs);
+        return;
+    }
+    for (unsigned aix = 0; aix < num_segments; ++aix) {
+        allocs[aix] = mem_new_alloc((pool_pt) mgr, alloc_size);
+    }
+
+    size_t nodes = (size_t) mgr->node_heap_chunks * MEM_NODE_HEAP_CHUNK_NODES;
+    size_t directory = (size_t) mgr->node_heap_capacity * sizeof(node_pt);
+    size_t entries = mgr->alloc_map_capacity;
+    printf("%u segments\n", mgr->pool.num_allocs + mgr->pool.num_gaps);
+    bench_layout_line("pointers", sizeof(wide_node_t),
+                      nodes * sizeof(wide_node_t) + directory + entries * sizeof(wide_node_t *),
+                      num_segments);
+    bench_layout_line("indices", sizeof(node_t),
+                      nodes * sizeof(node_t) + directory + entries * sizeof(*mgr->alloc_map),
+                      num_segments);
+
+    for (unsigned aix = num_segments; aix > 0; aix--) {
+        mem_del_alloc((pool_pt) mgr, allocs[aix - 1]);
+    }
+    free(allocs);
+    mem_pool_close((pool_pt) mgr);
+}
+
+
+/*******************************************/
+/***     3. NEXT_FIT VS FIRST_FIT        ***/
+/*******************************************/
+
+/*
+ * Runs the test_pool_stresstest workload on a single pool: 1000
+ * allocations of growing size, deallocation of every other one, and then
+ * a refill of 500 small allocations into the gaps. Reports the nodes the
+ * search visits per allocation in the two allocating phases.
+ */
+static void bench_search_steps(alloc_policy policy, const char *name) {
+    const unsigned num_allocations = 1000;
+    const unsigned min_alloc_size = 10;
+    const unsigned pool_size =
+            (num_allocations / 2) *
+            (2 * min_alloc_size + (num_allocations - 1) * min_alloc_size);
+
+    pool_mgr_pt mgr = (pool_mgr_pt) mem_pool_open(pool_size, policy);
+    if (mgr == NULL) {
+        return;
+    }
+
+    mgr->search_steps = 0;
+    for (unsigned aix = 0; aix < num_allocations; ++aix) {
+        mem_new_alloc((pool_pt) mgr, (aix + 1) * min_alloc_size);
+    }
+    double fill_steps = (double) mgr->search_steps / num_allocations;
+
+    // deallocate every other allocation (frees don't move the node heap)
+    node_pt *nodes = bench_allocated_nodes(mgr);
+    for (unsigned aix = 1; nodes && nodes[aix - 1] && nodes[aix]; aix += 2) {
+        mem_del_alloc((pool_pt) mgr, (alloc_pt) nodes[aix]);
+    }
+    free(nodes);
+
+    mgr->search_steps = 0;
+    for (unsigned aix = 0; aix < num_allocations / 2; ++aix) {
+        mem_new_alloc((pool_pt) mgr, min_alloc_size);
+    }
+    double refill_steps = (double) mgr->search_steps / (num_allocations / 2);
+
+    printf("%10s: %8.1f steps per allocation (fill), %8.1f (refill)\n",
+           name, fill_steps, refill_steps);
+
+    nodes = bench_allocated_nodes(mgr);
+    for (unsigned aix = 0; nodes && nodes[aix]; ++aix) {
+        mem_del_alloc((pool_pt) mgr, (alloc_pt) nodes[aix]);
+    }
+    free(nodes);
+    mem_pool_close((pool_pt) mgr);
+}
+
+
+/*******************************************/
+/***          4. BOUNDARY TAGS           ***/
+/*******************************************/
+
+// bytes of segment metadata a pool holds, in or out of pool.mem
+static size_t bench_metadata_bytes(pool_mgr_pt mgr) {
+    if (mgr->pool.policy == TAGGED_FIT) {
+        return (size_t) (mgr->pool.num_allocs + mgr->pool.num_gaps) * (sizeof(tag_t) + sizeof(size_t));
+    }
+    if (mgr->pool.policy == BITMAP_FIT) {
+        return (size_t) mgr->pool.num_allocs * MEM_BITMAP_GRANULE
+               + 2 * (mgr->bitmap_granules + 63) / 64 * sizeof(unsigned long long);
+    }
+    return (size_t) mgr->node_heap_chunks * MEM_NODE_HEAP_CHUNK_NODES * sizeof(node_t)
+           + (size_t) mgr->node_heap_capacity * sizeof(node_pt)
+           + (size_t) mgr->gap_ix_capacity * sizeof(gap_t)
+           + (size_t) mgr->alloc_map_capacity * sizeof(*mgr->alloc_map);
+}
+
+/*
+ * Runs the same workload on a node heap, a boundary tag and a bitmap pool:
+ * num_allocs allocations of 16 to 256 bytes, deallocation and refill of
+ * every other one, and deallocation of all. Reports the time per call
+ * and the metadata per allocation when the pool is full.
+ */
+static void bench_tags(alloc_policy policy, const char *name, unsigned num_allocs) {
+    pool_mgr_pt mgr = (pool_mgr_pt) mem_pool_open((size_t) num_allocs * 320, policy);
+    alloc_pt *allocs = calloc(num_allocs, sizeof(alloc_pt));
+    if (mgr == NULL || allocs == NULL) {
+        free(allocs);
+        return;
+    }
+
+    bench_rand_state = 88172645463325252UL; // the same sizes for every pool
+    double start = bench_now();
+    for (unsigned aix = 0; aix < num_allocs; ++aix) {
+        allocs[aix] = mem_new_alloc((pool_pt) mgr, 16 + bench_rand() % 241);
+    }
+    double elapsed = bench_now() - start;
+    size_t metadata = bench_metadata_bytes(mgr);
+
+    start = bench_now();
+    for (unsigned aix = 1; aix < num_allocs; aix += 2) {
+        mem_del_alloc((pool_pt) mgr, allocs[aix]);
+    }
+    for (unsigned aix = 1; aix < num_allocs; aix += 2) {
+        allocs[aix] = mem_new_alloc((pool_pt) mgr, 16 + bench_rand() % 241);
+    }
+    for (unsigned aix = 0; aix < num_allocs; ++aix) {
+        mem_del_alloc((pool_pt) mgr, allocs[aix]);
+    }
+    elapsed += bench_now() - start;
+
+    printf("%10s, %8u allocations: %8.1f ns per call, %6.1f metadata bytes per allocation\n",
+           name, num_allocs, elapsed * 1e9 / (3 * num_allocs),
+           (double) metadata / num_allocs);
+
+    free(allocs);
+    mem_pool_close((pool_pt) mgr);
+}
+
+
+/*******************************************/
+/***          5. SIZE CLASS SCAN         ***/
+/*******************************************/
+
+/*
+ * Fills one SEGREGATED_FIT size class with num_gaps gaps of which only
+ * the oldest fits the request, so that every search scans the whole
+ * class, and reports the gaps scanned per nanosecond.
+ */
+static void bench_seg_scan(unsigned num_gaps) {
+    pool_mgr_pt mgr = (pool_mgr_pt) mem_pool_open(1, SEGREGATED_FIT);
+    if (mgr == NULL) {
+        return;
+    }
+    _mem_remove_from_gap_ix(mgr, _mem_node(mgr, MEM_NODE_HEAD)->alloc_record.size, MEM_NODE_HEAD);
+
+    unsigned *nodes = calloc(num_gaps, sizeof(unsigned));
+    if (nodes == NULL || _mem_resize_node_heap(mgr, num_gaps) != ALLOC_OK) {
+        free(nodes);
+        mem_pool_close((pool_pt) mgr);
+        return;
+    }
+    for (unsigned u = 0; u < num_gaps; u++) {
+        nodes[u] = _mem_acquire_node(mgr);
+        node_pt node = _mem_node(mgr, nodes[u]);
+        node->alloc_record.mem = (char *) node;
+        node->alloc_record.size = (u == 0) ? 2000 : 1024 + bench_rand() % 512;
+        _mem_add_to_gap_ix(mgr, node->alloc_record.size, nodes[u]);
+    }
+
+    unsigned ops = BENCH_SCAN_ENTRIES / num_gaps;
+    unsigned found = 0;
+    double start = bench_now();
+    for (unsigned op = 0; op < ops; op++) {
+        found += (_mem_find_seg_gap(mgr, 1800 + op % 200) == nodes[0]);
+    }
+    double elapsed = bench_now() - start;
+
+    printf("%10u gaps: %8.2f gaps scanned per ns%s\n",
+           num_gaps, (double) num_gaps * ops / (elapsed * 1e9),
+           (found == ops) ? "" : " (wrong gap found)");
+
+    for (unsigned u = 0; u < num_gaps; u++) {
+        _mem_remove_from_gap_ix(mgr, _mem_node(mgr, nodes[u])->alloc_record.size, nodes[u]);
+        _mem_release_node(mgr, nodes[u]);
+    }
+    free(nodes);
+    _mem_add_to_gap_ix(mgr, _mem_node(mgr, MEM_NODE_HEAD)->alloc_record.size, MEM_NODE_HEAD);
+    mem_pool_close((pool_pt) mgr);
+}
+
+
+/*******************************************/
+/***           6. BEST_FIT SCAN          ***/
+/*******************************************/
+
+/*
+ * Stand-in for a vectorized BEST_FIT: the sizes of all gaps packed in one
+ * array, with the gap_ix slot of each alongside. One pass finds the
+ * smallest fitting size, and a second the lowest address among the gaps
+ * of that size. The vectors compare as signed lanes, with the top bits
+ * flipped, as in _mem_seg_scan.
+ */
+static unsigned bench_packed_best_fit(pool_mgr_pt mgr, const size_t *sizes, const unsigned *slots,
+                                      unsigned n, size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+    size_t best = 0;
+    unsigned i = 0;
+#if defined(__AVX2__) && __SIZEOF_SIZE_T__ == 8
+    const __m256i flip = _mm256_set1_epi64x((long long) (1ULL << 63));
+    const __m256i key = _mm256_xor_si256(_mm256_set1_epi64x((long long) (size - 1)), flip);
+    __m256i least = _mm256_set1_epi64x(~(long long) (1ULL << 63)); // SIZE_MAX, flipped
+    for (; i + 4 <= n; i += 4) {
+        __m256i lanes = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (sizes + i)), flip);
+        __m256i fits = _mm256_and_si256(_mm256_cmpgt_epi64(lanes, key), _mm256_cmpgt_epi64(least, lanes));
+        least = _mm256_blendv_epi8(least, lanes, fits);
+    }
+    long long lane_least[4];
+    _mm256_storeu_si256((__m256i *) lane_least, least);
+    for (unsigned l = 0; l < 4; l++) {
+        size_t lane = (size_t) lane_least[l] ^ (1ULL << 63);
+        if (lane != (size_t) -1 && (best == 0 || lane < best)) {
+            best = lane;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (sizes[i] >= size && (best == 0 || sizes[i] < best)) {
+            best = sizes[i];
+        }
+    }
+    if (best == 0) {
+        return 0;
+    }
+
+    unsigned found = 0;
+    i = 0;
+#if defined(__AVX2__) && __SIZEOF_SIZE_T__ == 8
+    const __m256i want = _mm256_set1_epi64x((long long) best);
+    for (; i + 4 <= n; i += 4) {
+        __m256i lanes = _mm256_loadu_si256((const __m256i *) (sizes + i));
+        unsigned mask = (unsigned) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lanes, want)));
+        for (; mask != 0; mask &= mask - 1) {
+            unsigned slot = slots[i + __builtin_ctz(mask)];
+            if (found == 0 || mgr->gap_ix[slot].mem < mgr->gap_ix[found].mem) {
+                found = slot;
+            }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (sizes[i] == best && (found == 0 || mgr->gap_ix[slots[i]].mem < mgr->gap_ix[found].mem)) {
+            found = slots[i];
+        }
+    }
+    return mgr->gap_ix[found].node;
+}
+
+/*
+ * Fills the gap index of a BEST_FIT pool with num_gaps gaps of random size
+ * and times the same lookups by the packed scan and by descent of the tree.
+ */
+static void bench_best_fit_scan(unsigned num_gaps) {
+    pool_mgr_pt mgr = (pool_mgr_pt) mem_pool_open(1, BEST_FIT);
+    if (mgr == NULL) {
+        return;
+    }
+    _mem_remove_from_gap_ix(mgr, _mem_node(mgr, MEM_NODE_HEAD)->alloc_record.size, MEM_NODE_HEAD);
+
+    unsigned *nodes = bench_stand_in_gaps(mgr, num_gaps);
+    size_t *sizes = calloc(num_gaps, sizeof(size_t));
+    unsigned *slots = calloc(num_gaps, sizeof(unsigned));
+    size_t *requests = calloc(BENCH_GAP_IX_OPS, sizeof(size_t));
+    if (nodes != NULL && sizes != NULL && slots != NULL && requests != NULL) {
+        for (unsigned u = 0; u < num_gaps; u++) {
+            node_pt node = _mem_node(mgr, nodes[u]);
+            sizes[u] = node->alloc_record.size;
+            slots[u] = node->gap_slot;
+        }
+        for (unsigned op = 0; op < BENCH_GAP_IX_OPS; op++) {
+            requests[op] = 1 + bench_rand() % 4096;
+        }
+
+        unsigned ops = BENCH_SCAN_ENTRIES / num_gaps;
+        if (ops > BENCH_GAP_IX_OPS) {
+            ops = BENCH_GAP_IX_OPS;
+        }
+        unsigned long scan_sum = 0, tree_sum = 0;
+        double start = bench_now();
+        for (unsigned op = 0; op < ops; op++) {
+            scan_sum += bench_packed_best_fit(mgr, sizes, slots, num_gaps, requests[op]);
+        }
+        double scan = bench_now() - start;
+        start = bench_now();
+        for (unsigned op = 0; op < ops; op++) {
+            tree_sum += _mem_find_best_gap(mgr, requests[op]);
+        }
+        double tree = bench_now() - start;
+
+        printf("%10u gaps: %10.1f ns per scan, %8.1f ns per descent%s\n",
+               num_gaps, scan * 1e9 / ops, tree * 1e9 / ops,
+               (scan_sum == tree_sum) ? "" : " (results differ)");
+    }
+    free(requests);
+    free(slots);
+    free(sizes);
+
+    while (mgr->gap_ix_root) {
+        gap_pt gap = &mgr->gap_ix[mgr->gap_ix_root];
+        _mem_remove_from_gap_ix(mgr, gap->size, gap->node);
+    }
+    if (nodes != NULL) {
+        for (unsigned u = 0; u < num_gaps; u++) {
+            _mem_release_node(mgr, nodes[u]);
+        }
+    }
+    free(nodes);
+    _mem_add_to_gap_ix(mgr, _mem_node(mgr, MEM_NODE_HEAD)->alloc_record.size, MEM_NODE_HEAD);
+    mem_pool_close((pool_pt) mgr);
+}
+
+
+/*******************************************/
+/***          7. POOL REGISTRY           ***/
+/*******************************************/
+
+/*
+ * Keeps num_open pools open and times cycles of opening and closing one
+ * more short-lived pool, then reports the store slots ever used.
+ */
+static void bench_pool_churn(unsigned num_open, unsigned cycles) {
+    pool_pt *pools = calloc(num_open, sizeof(pool_pt));
+    if (pools == NULL) {
+        return;
+    }
+    for (unsigned u = 0; u < num_open; u++) {
+        pools[u] = mem_pool_open(1024, FIRST_FIT);
+    }
+
+    double start = bench_now();
+    for (unsigned cycle = 0; cycle < cycles; cycle++) {
+        pool_pt pool = mem_pool_open(1024, FIRST_FIT);
+        if (pool == NULL) {
+            break;
+        }
+        mem_pool_close(pool);
+    }
+    double elapsed = bench_now() - start;
+
+    printf("%8u pools open, %8u cycles: %8.1f ns per open/close, %8u store slots\n",
+           num_open, cycles, elapsed * 1e9 / cycles, default_ctx.pool_store_size);
+
+    for (unsigned u = 0; u < num_open; u++) {
+        if (pools[u] != NULL) {
+            mem_pool_close(pools[u]);
+        }
+    }
+    free(pools);
+}
+
+
+/*******************************************/
+/***              8. THREADS             ***/
+/*******************************************/
+
+typedef struct _bench_thread {
+    pthread_t thread;
+    pool_pt pool;
+    sharded_pool_pt sharded; // used instead of pool if set
+    unsigned long rand_state;
+} bench_thread_t, *bench_thread_pt;
+
+// BENCH_THREAD_OPS frees of a random one of BENCH_THREAD_LIVE allocations,
+// each followed by a new allocation of random size in its place
+static void *bench_thread_run(void *arg) {
+    bench_thread_pt self = (bench_thread_pt) arg;
+    alloc_pt live[BENCH_THREAD_LIVE] = {NULL};
+    for (unsigned op = 0; op < BENCH_THREAD_OPS; op++) {
+        self->rand_state ^= self->rand_state << 13;
+        self->rand_state ^= self->rand_state >> 7;
+        self->rand_state ^= self->rand_state << 17;
+        unsigned slot = (unsigned) (self->rand_state % BENCH_THREAD_LIVE);
+        size_t size = 16 + (self->rand_state >> 8) % 241;
+        if (self->sharded != NULL) {
+            if (live[slot] != NULL) {
+                mem_sharded_del_alloc(self->sharded, live[slot]);
+            }
+            live[slot] = mem_sharded_new_alloc(self->sharded, size);
+            continue;
+        }
+        if (live[slot] != NULL) {
+            mem_del_alloc(self->pool, live[slot]);
+        }
+        live[slot] = mem_new_alloc(self->pool, size);
+    }
+    for (unsigned slot = 0; slot < BENCH_THREAD_LIVE; slot++) {
+        if (live[slot] != NULL && self->sharded != NULL) {
+            mem_sharded_del_alloc(self->sharded, live[slot]);
+        } else if (live[slot] != NULL) {
+            mem_del_alloc(self->pool, live[slot]);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Runs num_threads threads of bench_thread_run, each in its own pool or
+ * all in one shared pool, and reports the total throughput.
+ */
+static double bench_threads(alloc_policy policy, unsigned num_threads, int shared) {
+    bench_thread_pt threads = calloc(num_threads, sizeof(bench_thread_t));
+    if (threads == NULL) {
+        return 0;
+    }
+    size_t pool_size = (size_t) BENCH_THREAD_LIVE * 256 * (shared ? num_threads : 1) * 2;
+    pool_pt shared_pool = shared ? mem_pool_open(pool_size, policy) : NULL;
+    for (unsigned t = 0; t < num_threads; t++) {
+        threads[t].pool = shared ? shared_pool : mem_pool_open(pool_size, policy);
+        threads[t].rand_state = 88172645463325252UL + t;
+    }
+
+    double start = bench_now();
+    for (unsigned t = 0; t < num_threads; t++) {
+        pthread_create(&threads[t].thread, NULL, bench_thread_run, &threads[t]);
+    }
+    for (unsigned t = 0; t < num_threads; t++) {
+        pthread_join(threads[t].thread, NULL);
+    }
+    double elapsed = bench_now() - start;
+    double mops = (double) num_threads * BENCH_THREAD_OPS / elapsed * 1e-6;
+
+    for (unsigned t = 0; t < num_threads; t++) {
+        if (!shared && threads[t].pool != NULL) {
+            mem_pool_close(threads[t].pool);
+        }
+    }
+    if (shared_pool != NULL) {
+        mem_pool_close(shared_pool);
+    }
+    free(threads);
+    return mops;
+}
+
+
+/*******************************************/
+/***          9. THREAD CACHES           ***/
+/*******************************************/
+
+/*
+ * Runs num_threads threads of bench_thread_run in one shared pool with the
+ * per-thread caches on, and reports the throughput and the cache hit rate.
+ */
+static void bench_tcache(alloc_policy policy, unsigned num_threads, double locked) {
+    bench_thread_pt threads = calloc(num_threads, sizeof(bench_thread_t));
+    size_t pool_size = (size_t) BENCH_THREAD_LIVE * 256 * num_threads * 2;
+    pool_pt pool = mem_pool_open(pool_size, policy);
+    if (threads == NULL || pool == NULL || mem_pool_enable_tcache(pool) != ALLOC_OK) {
+        free(threads);
+        return;
+    }
+    for (unsigned t = 0; t < num_threads; t++) {
+        threads[t].pool = pool;
+        threads[t].rand_state = 88172645463325252UL + t;
+    }
+
+    double start = bench_now();
+    for (unsigned t = 0; t < num_threads; t++) {
+        pthread_create(&threads[t].thread, NULL, bench_thread_run, &threads[t]);
+    }
+    // each thread flushes its cache as it exits
+    for (unsigned t = 0; t < num_threads; t++) {
+        pthread_join(threads[t].thread, NULL);
+    }
+    double elapsed = bench_now() - start;
+    double mops = (double) num_threads * BENCH_THREAD_OPS / elapsed * 1e-6;
+
+    unsigned long hits = 0, misses = 0;
+    mem_inspect_tcache(pool, &hits, &misses);
+    printf("%8u threads: %8.2f locked, %8.2f cached (%5.2fx), %6.2f%% hits\n",
+           num_threads, locked, mops, mops / locked, 100.0 * hits / (hits + misses));
+
+    mem_pool_close(pool);
+    free(threads);
+}
+
+
+/*******************************************/
+/***             10. SHARDS              ***/
+/*******************************************/
+
+/*
+ * Runs num_threads threads of bench_thread_run in one sharded pool of a
+ * shard per CPU, and reports the throughput and how evenly the shards
+ * were used.
+ */
+static void bench_sharded(alloc_policy policy, unsigned num_threads, double locked) {
+    bench_thread_pt threads = calloc(num_threads, sizeof(bench_thread_t));
+    size_t shard_size = (size_t) BENCH_THREAD_LIVE * 256 * num_threads * 2;
+    sharded_pool_pt pool = mem_sharded_pool_open(shard_size, policy, 0);
+    if (threads == NULL || pool == NULL) {
+        free(threads);
+        return;
+    }
+    for (unsigned t = 0; t < num_threads; t++) {
+        threads[t].sharded = pool;
+        threads[t].rand_state = 88172645463325252UL + t;
+    }
+
+    double start = bench_now();
+    for (unsigned t = 0; t < num_threads; t++) {
+        pthread_create(&threads[t].thread, NULL, bench_thread_run, &threads[t]);
+    }
+    for (unsigned t = 0; t < num_threads; t++) {
+        pthread_join(threads[t].thread, NULL);
+    }
+    double elapsed = bench_now() - start;
+    double mops = (double) num_threads * BENCH_THREAD_OPS / elapsed * 1e-6;
+
+    pool_t totals;
+    mem_inspect_sharded_pool(pool, &totals);
+    printf("%8u threads: %8.2f locked, %8.2f sharded (%5.2fx) over %u shards, %u left allocated\n",
+           num_threads, locked, mops, mops / locked, pool->num_shards, totals.num_allocs);
+
+    mem_sharded_pool_close(pool);
+    free(threads);
+}
+
+
+/*******************************************/
+/***          11. REMOTE FREES           ***/
+/*******************************************/
+
+// hands allocations from the producer to one consumer; head is written
+// only by the producer and tail only by the consumer
+typedef struct _bench_ring {
+    alloc_pt slots[BENCH_RING_SLOTS];
+    unsigned head;
+    char pad[MEM_CACHE_LINE];
+    unsigned tail;
+    pthread_t thread;
+    pool_pt pool;
+    int *done;
+} bench_ring_t, *bench_ring_pt;
+
+// frees what the producer sends until it is done and the ring is empty
+static void *bench_consumer_run(void *arg) {
+    bench_ring_pt ring = (bench_ring_pt) arg;
+    for (;;) {
+        unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (ring->tail == head) {
+            if (__atomic_load_n(ring->done, __ATOMIC_ACQUIRE) && ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+                return NULL;
+            }
+            sched_yield();
+            continue;
+        }
+        mem_del_alloc(ring->pool, ring->slots[ring->tail % BENCH_RING_SLOTS]);
+        __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * One producer allocates BENCH_THREAD_OPS messages in its pool and deals
+ * them out to num_consumers threads, which free them; with owned set, the
+ * frees go through the pool's remote free queue instead of its lock.
+ */
+static double bench_remote_free(alloc_policy policy, unsigned num_consumers, int owned) {
+    bench_ring_pt rings = calloc(num_consumers, sizeof(bench_ring_t));
+    size_t pool_size = (size_t) BENCH_RING_SLOTS * 256 * (num_consumers + 1) * 2;
+    pool_pt pool = mem_pool_open(pool_size, policy);
+    int done = 0;
+    if (rings == NULL || pool == NULL) {
+        free(rings);
+        return 0;
+    }
+    if (owned) {
+        mem_pool_set_owner(pool);
+    }
+    unsigned long rand_state = 88172645463325252UL;
+
+    double start = bench_now();
+    for (unsigned c = 0; c < num_consumers; c++) {
+        rings[c].pool = pool;
+        rings[c].done = &done;
+        pthread_create(&rings[c].thread, NULL, bench_consumer_run, &rings[c]);
+    }
+    for (unsigned op = 0; op < BENCH_THREAD_OPS; op++) {
+        rand_state ^= rand_state << 13;
+        rand_state ^= rand_state >> 7;
+        rand_state ^= rand_state << 17;
+        alloc_pt alloc;
+        while ((alloc = mem_new_alloc(pool, 16 + (rand_state >> 8) % 241)) == NULL) {
+            sched_yield(); // full until the consumers catch up
+        }
+        bench_ring_pt ring = &rings[op % num_consumers];
+        while (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == BENCH_RING_SLOTS) {
+            sched_yield();
+        }
+        ring->slots[ring->head % BENCH_RING_SLOTS] = alloc;
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+    for (unsigned c = 0; c < num_consumers; c++) {
+        pthread_join(rings[c].thread, NULL);
+    }
+    double elapsed = bench_now() - start;
+
+    mem_pool_close(pool);
+    free(rings);
+    return BENCH_THREAD_OPS / elapsed * 1e-6;
+}
+
+
+/*******************************************/
+/***          12. LOCK-FREE SLAB         ***/
+/*******************************************/
+
+/*
+ * Runs num_threads threads of bench_thread_run in one slab pool of 256-byte
+ * objects, and reports the total throughput.
+ */
+static double bench_lockfree(alloc_policy policy, unsigned num_threads) {
+    bench_thread_pt threads = calloc(num_threads, sizeof(bench_thread_t));
+    size_t count = (size_t) BENCH_THREAD_LIVE * num_threads;
+    pool_pt pool = (policy == LOCKFREE_SLAB_FIT) ? mem_pool_open_lockfree(256, count)
+                                                 : mem_pool_open_slab(256, count);
+    if (threads == NULL || pool == NULL) {
+        free(threads);
+        return 0;
+    }
+    for (unsigned t = 0; t < num_threads; t++) {
+        threads[t].pool = pool;
+        threads[t].rand_state = 88172645463325252UL + t;
+    }
+
+    double start = bench_now();
+    for (unsigned t = 0; t < num_threads; t++) {
+        pthread_create(&threads[t].thread, NULL, bench_thread_run, &threads[t]);
+    }
+    for (unsigned t = 0; t < num_threads; t++) {
+        pthread_join(threads[t].thread, NULL);
+    }
+    double elapsed = bench_now() - start;
+
+    mem_pool_close(pool);
+    free(threads);
+    return (double) num_threads * BENCH_THREAD_OPS / elapsed * 1e-6;
+}
+
+
+/*******************************************/
+/***        13. DRIVER ROUTINE           ***/
+/*******************************************/
+
+int main(int argc, char *argv[]) {
+    unsigned max_gaps = (argc > 1) ? (unsigned) strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_MAX_GAPS;
+
+    if (mem_init() != ALLOC_OK) {
+        return 1;
+    }
+
+    printf("FIRST_FIT gap index\n");
+    for (unsigned num_gaps = 100; num_gaps <= max_gaps; num_gaps *= 10) {
+        bench_gap_ix(FIRST_FIT, num_gaps);
+    }
+
+    printf("\nBEST_FIT gap index\n");
+    for (unsigned num_gaps = 100; num_gaps <= max_gaps; num_gaps *= 10) {
+        bench_gap_ix(BEST_FIT, num_gaps);
+    }
+
+    printf("\nGap index on the free path\n");
+    bench_gap_free(FIRST_FIT, "FIRST_FIT", BENCH_FREE_PATH_GAPS);
+    bench_gap_free(BEST_FIT, "BEST_FIT", BENCH_FREE_PATH_GAPS);
+
+    printf("\nNode heap\n");
+    for (unsigned num_allocs = 1000; num_allocs <= max_gaps; num_allocs *= 10) {
+        bench_node_heap(num_allocs);
+    }
+
+    printf("\nNode heap and allocation map at ");
+    bench_node_layout(BENCH_LAYOUT_SEGMENTS);
+
+    printf("\nSearch steps on the stress test workload\n");
+    bench_search_steps(FIRST_FIT, "FIRST_FIT");
+    bench_search_steps(NEXT_FIT, "NEXT_FIT");
+
+    printf("\nSEGREGATED_FIT size class scan\n");
+    for (unsigned num_gaps = 1000; num_gaps <= max_gaps && num_gaps <= 100000; num_gaps *= 10) {
+        bench_seg_scan(num_gaps);
+    }
+
+    printf("\nBEST_FIT scan vs tree\n");
+    for (unsigned num_gaps = 10; num_gaps <= max_gaps && num_gaps <= 100000; num_gaps *= 10) {
+        bench_best_fit_scan(num_gaps);
+    }
+
+    printf("\nPool open/close churn\n");
+    for (unsigned num_open = 1; num_open <= 10000; num_open *= 100) {
+        bench_pool_churn(num_open, BENCH_POOL_CYCLES);
+    }
+
+    printf("\nNode heap vs boundary tags vs granule bitmap\n");
+    for (unsigned num_allocs = 1000; num_allocs <= max_gaps; num_allocs *= 10) {
+        bench_tags(SEGREGATED_FIT, "node heap", num_allocs);
+        bench_tags(TAGGED_FIT, "tags", num_allocs);
+        bench_tags(BITMAP_FIT, "bitmap", num_allocs);
+    }
+
+    // twice the cores, to show where the scaling stops
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned max_threads = (cores > 0 && 2 * cores < BENCH_MAX_THREADS) ? 2 * (unsigned) cores : BENCH_MAX_THREADS;
+    printf("\nThreads on %ld cores, TLSF_FIT, Mops/s (speedup over 1 thread)\n", cores);
+    double own_base = bench_threads(TLSF_FIT, 1, 0);
+    double shared_base = bench_threads(TLSF_FIT, 1, 1);
+    for (unsigned num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        double own = (num_threads == 1) ? own_base : bench_threads(TLSF_FIT, num_threads, 0);
+        double shared = (num_threads == 1) ? shared_base : bench_threads(TLSF_FIT, num_threads, 1);
+        printf("%8u threads: %8.2f (%5.2fx) in own pools, %8.2f (%5.2fx) in one pool\n",
+               num_threads, own, own / own_base, shared, shared / shared_base);
+    }
+
+    printf("\nThreads in one TLSF_FIT pool, locked vs per-thread caches, Mops/s\n");
+    for (unsigned num_threads = 1; num_threads <= BENCH_MAX_THREADS; num_threads *= 2) {
+        bench_tcache(TLSF_FIT, num_threads, bench_threads(TLSF_FIT, num_threads, 1));
+    }
+
+    printf("\nThreads in one TLSF_FIT pool vs a shard per CPU, Mops/s\n");
+    for (unsigned num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        bench_sharded(TLSF_FIT, num_threads, bench_threads(TLSF_FIT, num_threads, 1));
+    }
+
+    printf("\nOne producer, N consumers freeing in its TLSF_FIT pool, Mops/s\n");
+    for (unsigned num_consumers = 1; num_consumers <= max_threads; num_consumers *= 2) {
+        double locked = bench_remote_free(TLSF_FIT, num_consumers, 0);
+        double queued = bench_remote_free(TLSF_FIT, num_consumers, 1);
+        printf("%8u consumers: %8.2f locked, %8.2f queued (%5.2fx)\n",
+               num_consumers, locked, queued, queued / locked);
+    }
+
+    printf("\nThreads in one slab pool, locked vs lock-free, Mops/s\n");
+    for (unsigned num_threads = 1; num_threads <= BENCH_MAX_THREADS; num_threads *= 2) {
+        double locked = bench_lockfree(SLAB_FIT, num_threads);
+        double lockfree = bench_lockfree(LOCKFREE_SLAB_FIT, num_threads);
+        printf("%8u threads: %8.2f locked, %8.2f lock-free (%5.2fx)\n",
+               num_threads, locked, lockfree, lockfree / locked);
+    }
+
+    return (mem_free() == ALLOC_OK) ? 0 : 1;
+}
@@ -8,6 +8,9 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
+#ifdef MEM_POOL_THREADS
+#include <pthread.h>
+#endif
 
 #include "cmocka.h"
 #include "mem_pool.h"
@@ -190,6 +193,93 @@ static void test_pool_smoketest(void **state) {
     }
 }
 
+static void test_pool_store_reuse(void **state) {
+    (void) state; /* unused */
+
+    // more pools than the store starts with room for
+    pool_pt pools[50];
+    const unsigned NUM_POOLS = sizeof(pools) / sizeof(pools[0]);
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Opening %u pools\n", NUM_POOLS);
+    for (unsigned i = 0; i < NUM_POOLS; i++) {
+        pools[i] = mem_pool_open(POOL_SIZE, FIRST_FIT);
+        assert_non_null(pools[i]);
+    }
+
+    INFO("Closing every other pool, then reopening it in a reused slot\n");
+    for (unsigned i = 0; i < NUM_POOLS; i += 2) {
+        status = mem_pool_close(pools[i]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+    for (unsigned i = 0; i < NUM_POOLS; i += 2) {
+        pools[i] = mem_pool_open(POOL_SIZE, BEST_FIT);
+        assert_non_null(pools[i]);
+        assert_int_equal(pools[i]->policy, BEST_FIT);
+    }
+
+    INFO("Closing the pool store with all pools open\n");
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+static void test_pool_close_after_free(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Closing the pool store with a pool still in use\n");
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    alloc_pt alloc = mem_new_alloc(pool, 100);
+    assert_non_null(alloc);
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Closing the pool after the pool store\n");
+    status = mem_del_alloc(pool, alloc);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Closing a pool of the previous pool store\n");
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+    pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    alloc = mem_new_alloc(pool, 100);
+    assert_non_null(alloc);
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+    // these take the slots the old pool had, which its close must leave alone
+    pool_pt pools[2];
+    for (unsigned i = 0; i < 2; i++) {
+        pools[i] = mem_pool_open(POOL_SIZE, BEST_FIT);
+        assert_non_null(pools[i]);
+    }
+    status = mem_del_alloc(pool, alloc);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_pool_close(pools[0]);
+    assert_int_equal(status, ALLOC_OK);
+    pools[0] = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pools[0]);
+    pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    INFO("Closing the pool store with all pools open\n");
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
 static void test_pool_nonempty(void **state) {
     (void) state; /* unused */
 
@@ -222,10 +312,21 @@ static void test_pool_nonempty(void **state) {
     assert_int_equal(status, ALLOC_NOT_FREED);
     INFO(" failed.\n");
 
+    INFO("Trying to deallocate a copy of the allocation record...");
+    alloc_t copy = *alloc;
+    status = mem_del_alloc(pool, &copy);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    INFO(" failed.\n");
+
     INFO("Deallocating 100 bytes\n");
     status = mem_del_alloc(pool, alloc);
     assert_int_equal(status, ALLOC_OK);
 
+    INFO("Trying to deallocate 100 bytes again...");
+    status = mem_del_alloc(pool, alloc);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    INFO(" failed.\n");
+
     INFO("Closing pool\n");
     status = mem_pool_close(pool);
     assert_int_equal(status, ALLOC_OK);
@@ -234,6 +335,38 @@ static void test_pool_nonempty(void **state) {
     assert_int_equal(status, ALLOC_OK);
 }
 
+static void test_pool_addr_zero_size(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    INFO("Allocating 0 bytes, then 10 bytes at the same address\n");
+    alloc_pt alloc = mem_new_alloc(pool, 0);
+    assert_non_null(alloc);
+    char *mem = mem_new_alloc_addr(pool, 10);
+    assert_non_null(mem);
+    assert_ptr_equal(alloc->mem, mem);
+
+    INFO("Deallocating by address frees the 10 bytes\n");
+    status = mem_del_alloc_addr(pool, mem);
+    assert_int_equal(status, ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 1, 1);
+    status = mem_del_alloc_addr(pool, mem);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+
+    INFO("Deallocating the 0 bytes\n");
+    status = mem_del_alloc(pool, alloc);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
 
 /*******************************************/
 /***       2. USER-FACING METADATA       ***/
@@ -1531,6 +1664,77 @@ static void test_pool_scenario10(void **state) {
     check_pool(pool, exp0);
 }
 
+static void test_pool_scenario25(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 25:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 5 x 100, then the rest of the pool.
+     * 3. Deallocate 1.
+     * 4. Allocate 40. The 60 left over is the lowest gap in the
+     *    pool, but its node is the newest one on the node heap.
+     * 5. Deallocate 3.
+     * 6. Allocate 50. Placement follows addresses, not node heap
+     *    slots, so the 60 is taken over the 100 after it.
+     * 7. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 5;
+
+    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    alloc_pt rest = mem_new_alloc(pool, pool->total_size - 500);
+    assert_non_null(rest);
+
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+    alloc_pt alloc0 = mem_new_alloc(pool, 40);
+    assert_non_null(alloc0);
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK); allocs[3]=0;
+    alloc_pt alloc1 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc1);
+
+    pool_segment_t exp1[8] =
+            {
+                    {100, 1},
+                    {40, 1},
+                    {50, 1},
+                    {10, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {pool->total_size - 500, 1},
+            };
+    check_pool(pool, exp1);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i]) {
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        }
+    }
+    assert_int_equal(mem_del_alloc(pool, rest), ALLOC_OK);
+
+    check_pool(pool, exp0);
+
+    free(allocs);
+}
+
 /*******************************************/
 /***        4. BEST_FIT SCENARIOS        ***/
 /*******************************************/
@@ -2316,141 +2520,1490 @@ static void test_pool_scenario19(void **state) {
 }
 
 /*******************************************/
-/***          5. STRESS TEST             ***/
-/***                                     ***/
-/***         [non-functional]            ***/
-/***         [see NOTE below]            ***/
+/***     5. SEGREGATED_FIT SCENARIOS     ***/
 /*******************************************/
 
-void test_pool_stresstest(void **state) {
-    (void) state; /* unused */
-
-    const unsigned num_pools = 200;
-    const unsigned num_allocations = 1000;
-    const unsigned min_alloc_size = 10;
-    const unsigned pool_size =
-            (num_allocations / 2) *
-            (2 * min_alloc_size + (num_allocations - 1) * min_alloc_size);
-    assert_int_equal(pool_size, 5005000);
+static int pool_sf_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = SEGREGATED_FIT;
+    pool_pt pool = NULL;
 
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
 
-    pool_pt pools[num_pools];
-    alloc_pt allocations[num_pools][num_allocations];
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "SEGREGATED_FIT");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
 
-    /*
-     * NOTE: This will work iff the address of the allocation
-     * in the pool is returned to the user instead of the
-     * address of the allocation record. Since allocation records
-     * are a part of the nodes, when the node heap is reallocated
-     * the node addresses shift with it, and so do the allocation
-     * record addresses. The allocation addresses on the pool
-     * remain the same, however, so they can be returned to the
-     * user and gotten from the user upon request for deletion.
-     */
+    *state = pool;
 
-    /*
-     * Testing dynamic reallocation of pool structures:
-     *
-     * 1. 200 pools of 5005000 each (many pools)
-     * 2. In each pool 1000 allocations of different sizes (many allocations)
-     * 3. In each pool 500 deallocations (many gaps)
-     */
+    return 0;
+}
 
-    // initialize store
-    assert_int_equal(mem_init(), ALLOC_OK);
+static int pool_sf_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
 
-    // allocate pools
-    for (unsigned pix=0; pix < num_pools; ++pix) {
-        // open pool
-        pools[pix] =
-                mem_pool_open(pool_size, (pix % 2) ? FIRST_FIT : BEST_FIT);
-        assert_non_null(pools[pix]);
-        // allocate pool
-        unsigned allocated = 0;
-        for (unsigned aix=0; aix < num_allocations; ++aix) {
-            allocations[pix][aix] =
-                    mem_new_alloc(pools[pix], (aix + 1) * min_alloc_size);
-            allocated += (aix + 1) * min_alloc_size;
-            if (!allocations[pix][aix]) {
-                INFO("ASSERT WILL FAIL at pix = %u, aix = %u, allocated = %u\n", pix, aix, allocated);
-            }
-            assert_non_null(allocations[pix][aix]);
-        }
-        // delete every other allocation
-        for (unsigned aix=0; aix < num_allocations; ++aix) {
-            if (aix % 2) {
-                assert_int_equal(
-                        mem_del_alloc(pools[pix], allocations[pix][aix]),
-                        ALLOC_OK);
-                allocations[pix][aix] = NULL;
-            }
-        }
-    }
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
 
-    // delete pools
-    for (unsigned pix=0; pix < num_pools; ++pix) {
-        // delete pool's allocations
-        for (unsigned aix=0; aix < num_allocations; ++aix) {
-            if (allocations[pix][aix]) {
-                // delete allocation
-                assert_int_equal(
-                    mem_del_alloc(pools[pix], allocations[pix][aix]),
-                    ALLOC_OK);
-            }
-        }
-        // close pool
-        assert_int_equal(mem_pool_close(pools[pix]), ALLOC_OK);
-    }
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
 
-    // free store
-    assert_int_equal(mem_free(), ALLOC_OK);
+    return 0;
 }
 
+static void test_pool_scenario20(void **state) {
+    pool_pt pool = *state;
 
-/*******************************************/
-/***         6. DRIVER ROUTINE           ***/
-/*******************************************/
+    /*
+     * Scenario 20:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100.
+     * 3. Deallocate 1, 4, 7
+     * 4. Allocate 120. Too big for the 100 gaps in its class, so it
+     *    goes to the end of the pool.
+     * 5. Allocate 100. Takes the most recently freed gap (7).
+     * 6. Allocate 50. Its class is empty, so it takes a gap from the
+     *    next non-empty class (4).
+     * 7. Clean up.
+     */
 
-int run_test_suite() {
-    const struct CMUnitTest tests[] = {
-            cmocka_unit_test(test_pool_store_smoketest),
-            cmocka_unit_test(test_pool_smoketest),
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
 
-            cmocka_unit_test(test_pool_nonempty),
 
-            cmocka_unit_test_setup_teardown(test_pool_ff_metadata, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_bf_metadata, pool_bf_setup, pool_bf_teardown),
+    const unsigned NUM_ALLOCS = 10;
 
-            cmocka_unit_test_setup_teardown(test_pool_scenario00, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario01, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario02, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario03, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario04, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario05, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario06, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario07, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario08, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario09, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario10, pool_ff_setup, pool_ff_teardown),
+    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
+    assert_non_null(allocs);
 
-            cmocka_unit_test_setup_teardown(test_pool_scenario11, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario12, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario13, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario14, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario15, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario16, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario17, pool_bf_setup, pool_bf_teardown),
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 120);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc2);
+
+    pool_segment_t exp1[13] =
+            {
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 1},
+                    {50, 1},
+                    {50, 0},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {120, 1},
+                    {pool->total_size - 1120, 0},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, SEGREGATED_FIT, POOL_SIZE, 970, 10, 3);
+
+
+    // clean up
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+/*******************************************/
+/***        6. TLSF_FIT SCENARIOS        ***/
+/*******************************************/
+
+static int pool_tf_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = TLSF_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "TLSF_FIT");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_tf_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario21(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 21:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100.
+     * 3. Deallocate 2, 5
+     * 4. Allocate 101. Rounded up past the class of the 100 gaps,
+     *    so it goes to the end of the pool.
+     * 5. Allocate 100. Takes the most recently freed gap (5).
+     * 6. Allocate 60. Takes the remaining 100 gap (2) from the next
+     *    non-empty class.
+     * 7. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 10;
+
+    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 101);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 60);
+    assert_non_null(alloc2);
+
+    pool_segment_t exp1[13] =
+            {
+                    {100, 1},
+                    {100, 1},
+                    {60, 1},
+                    {40, 0},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {101, 1},
+                    {pool->total_size - 1101, 0},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, TLSF_FIT, POOL_SIZE, 1061, 11, 2);
+
+
+    // clean up
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+/*******************************************/
+/***       7. BUDDY_FIT SCENARIOS        ***/
+/*******************************************/
+
+static int pool_buddy_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = BUDDY_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "BUDDY_FIT");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_buddy_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void check_buddy(pool_pt pool, const unsigned *exp, unsigned num_orders) {
+    unsigned *counts = NULL;
+    unsigned size = 0;
+
+    mem_inspect_buddy(pool, &counts, &size);
+
+    assert_non_null(counts);
+    assert_int_equal(size, num_orders);
+    assert_memory_equal(exp, counts, size * sizeof(unsigned));
+
+    free(counts);
+}
+
+static void test_pool_scenario22(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 22:
+     *
+     * 1. Pool starts out as one free block per set bit of its size:
+     *    1000000 = 2^19 + 2^18 + 2^17 + 2^16 + 2^14 + 2^9 + 2^6
+     * 2. Allocate 100. Rounds up to 128, which is split off the 512
+     *    block, leaving free buddies of 128 and 256.
+     * 3. Allocate 60. Takes the 64 block whole.
+     * 4. Deallocate the 100. The 128 and 256 buddies merge back
+     *    into the 512.
+     * 5. Deallocate the 60.
+     */
+
+    pool_segment_t exp0[7] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {512, 0},
+                    {64, 0},
+            };
+    check_pool(pool, exp0);
+    unsigned orders0[20] = {0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 1, 0, 1, 1, 1, 1};
+    check_buddy(pool, orders0, 20);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    assert_int_equal(alloc0->size, 100);
+
+    pool_segment_t exp1[9] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {128, 1},
+                    {128, 0},
+                    {256, 0},
+                    {64, 0},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, BUDDY_FIT, POOL_SIZE, 100, 1, 8);
+    unsigned orders1[20] = {0, 0, 0, 0, 0, 0, 1, 1, 1, 0, 0, 0, 0, 0, 1, 0, 1, 1, 1, 1};
+    check_buddy(pool, orders1, 20);
+
+
+    alloc_pt alloc1 = mem_new_alloc(pool, 60);
+    assert_non_null(alloc1);
+
+    pool_segment_t exp2[9] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {128, 1},
+                    {128, 0},
+                    {256, 0},
+                    {64, 1},
+            };
+    check_pool(pool, exp2);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+    pool_segment_t exp3[7] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {512, 0},
+                    {64, 1},
+            };
+    check_pool(pool, exp3);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    check_pool(pool, exp0);
+    check_buddy(pool, orders0, 20);
+}
+
+/*******************************************/
+/***        8. NEXT_FIT SCENARIOS        ***/
+/*******************************************/
+
+static int pool_nf_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = NEXT_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "NEXT_FIT");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_nf_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario23(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 23:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100, then the rest of the pool.
+     * 3. Deallocate 1, 5, 8
+     * 4. Allocate 50. The search wraps around to the head and
+     *    takes the first gap (1).
+     * 5. Allocate 80. The 50 left of gap 1 is too small, so it
+     *    moves on to gap 5.
+     * 6. Allocate 40. First fit would go back to gap 1, but the
+     *    search resumes after gap 5 and takes gap 8.
+     * 7. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 10;
+
+    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    alloc_pt rest = mem_new_alloc(pool, pool->total_size - 1000);
+    assert_non_null(rest);
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 80);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 40);
+    assert_non_null(alloc2);
+
+    pool_segment_t exp1[14] =
+            {
+                    {100, 1},
+                    {50, 1},
+                    {50, 0},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {80, 1},
+                    {20, 0},
+                    {100, 1},
+                    {100, 1},
+                    {40, 1},
+                    {60, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 1},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, NEXT_FIT, POOL_SIZE, 999870, 11, 3);
+
+
+    // clean up
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, rest), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+/*******************************************/
+/***        9. WORST_FIT SCENARIOS       ***/
+/*******************************************/
+
+static int pool_wf_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = WORST_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "WORST_FIT");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_wf_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario24(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 24:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100, then the rest of the pool.
+     * 3. Deallocate 2, (5, 6)
+     * 4. Allocate 50. Takes the largest gap (5, 6).
+     * 5. Allocate 50. The 150 left over is still the largest.
+     * 6. Allocate 60. Both gaps are 100, the one at the higher
+     *    address (5, 6) is taken.
+     * 7. Allocate 200. Doesn't fit in any gap.
+     * 8. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 10;
+
+    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    alloc_pt rest = mem_new_alloc(pool, pool->total_size - 1000);
+    assert_non_null(rest);
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 60);
+    assert_non_null(alloc2);
+    assert_null(mem_new_alloc(pool, 200));
+
+    pool_segment_t exp1[13] =
+            {
+                    {100, 1},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 1},
+                    {50, 1},
+                    {50, 1},
+                    {60, 1},
+                    {40, 0},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {pool->total_size - 1000, 1},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, WORST_FIT, POOL_SIZE, 999860, 11, 2);
+
+
+    // clean up
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, rest), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+/*******************************************/
+/***          10. SLAB POOLS             ***/
+/*******************************************/
+
+static void test_pool_slab(void **state) {
+    (void) state; /* unused */
+
+    const unsigned OBJ_SIZE = 60;  // stored at a word-aligned stride of 64
+    const unsigned OBJ_COUNT = 100;
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    assert_null(mem_pool_open(POOL_SIZE, SLAB_FIT));
+
+    INFO("Allocating slab pool of %u x %u bytes\n", OBJ_COUNT, OBJ_SIZE);
+    pool_pt pool = mem_pool_open_slab(OBJ_SIZE, OBJ_COUNT);
+    assert_non_null(pool);
+    check_metadata(pool, SLAB_FIT, 6400, 0, 0, 1);
+
+    INFO("Allocating 3 objects\n");
+    alloc_pt alloc0 = mem_new_alloc(pool, OBJ_SIZE);
+    alloc_pt alloc1 = mem_new_alloc(pool, OBJ_SIZE);
+    alloc_pt alloc2 = mem_new_alloc(pool, OBJ_SIZE - 10);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_int_equal(alloc1->mem - alloc0->mem, 64);
+    assert_int_equal(alloc2->size, OBJ_SIZE - 10);
+    assert_null(mem_new_alloc(pool, OBJ_SIZE + 1));
+
+    INFO("Deallocating the middle object\n");
+    status = mem_del_alloc(pool, alloc1);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, alloc1);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+
+    pool_segment_t exp1[4] =
+            {
+                    {64, 1},
+                    {64, 0},
+                    {64, 1},
+                    {6400 - 192, 0},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, SLAB_FIT, 6400, 110, 2, 2);
+
+    INFO("Reallocating the freed object\n");
+    alloc_pt alloc3 = mem_new_alloc(pool, OBJ_SIZE);
+    assert_ptr_equal(alloc3, alloc1);
+    check_metadata(pool, SLAB_FIT, 6400, 170, 3, 1);
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    pool_segment_t exp0[1] =
+            {
+                    {6400, 0},
+            };
+    check_pool(pool, exp0);
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+/*******************************************/
+/***         11. BOUNDARY TAGS           ***/
+/*******************************************/
+
+static void test_pool_tagged(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating tagged pool of 1004 bytes (1000 in whole words)\n");
+    pool_pt pool = mem_pool_open(1004, TAGGED_FIT);
+    assert_non_null(pool);
+    check_metadata(pool, TAGGED_FIT, 1000, 0, 0, 1);
+
+    // segments are reported by extent: 32 bytes of tags, the size
+    // rounded up to a word, and at least 48 bytes
+    INFO("Allocating 100, 10, and 200 bytes\n");
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 10);
+    char *mem2 = mem_new_alloc_addr(pool, 200);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(mem2);
+    assert_int_equal(alloc1->mem - alloc0->mem, 136);
+    assert_int_equal(mem2 - alloc1->mem, 48);
+    assert_int_equal(alloc1->size, 10);
+    assert_null(mem_new_alloc(pool, 1000));
+
+    INFO("Deallocating the middle allocation\n");
+    status = mem_del_alloc(pool, alloc1);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, alloc1);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+
+    pool_segment_t exp1[4] =
+            {
+                    {136, 1},
+                    {48, 0},
+                    {232, 1},
+                    {584, 0},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, TAGGED_FIT, 1000, 300, 2, 2);
+
+    INFO("Reallocating the freed segment\n");
+    alloc_pt alloc3 = mem_new_alloc(pool, 10);
+    assert_ptr_equal(alloc3, alloc1);
+    check_metadata(pool, TAGGED_FIT, 1000, 310, 3, 1);
+
+    status = mem_del_alloc_addr(pool, alloc0->mem + 8);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+
+    INFO("Deallocating all, merging both neighbours last\n");
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc_addr(pool, mem2), ALLOC_OK);
+
+    pool_segment_t exp2[3] =
+            {
+                    {136, 0},
+                    {48, 1},
+                    {816, 0},
+            };
+    check_pool(pool, exp2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    pool_segment_t exp0[1] =
+            {
+                    {1000, 0},
+            };
+    check_pool(pool, exp0);
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+/*******************************************/
+/***         12. GRANULE BITMAP          ***/
+/*******************************************/
+
+static void test_pool_bitmap(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating bitmap pool of 1000 bytes (992 in whole granules)\n");
+    pool_pt pool = mem_pool_open(1000, BITMAP_FIT);
+    assert_non_null(pool);
+    check_metadata(pool, BITMAP_FIT, 992, 0, 0, 1);
+
+    // segments are reported in 16-byte granules: one for the record, and
+    // the size rounded up
+    INFO("Allocating 100, 10, and 200 bytes\n");
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 10);
+    char *mem2 = mem_new_alloc_addr(pool, 200);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(mem2);
+    assert_int_equal(alloc1->mem - alloc0->mem, 128);
+    assert_int_equal(mem2 - alloc1->mem, 32);
+    assert_int_equal(alloc1->size, 10);
+    assert_null(mem_new_alloc(pool, 600));
+
+    INFO("Deallocating the middle allocation\n");
+    status = mem_del_alloc(pool, alloc1);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, alloc1);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+
+    pool_segment_t exp1[4] =
+            {
+                    {128, 1},
+                    {32, 0},
+                    {224, 1},
+                    {608, 0},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, BITMAP_FIT, 992, 300, 2, 2);
+
+    INFO("Allocating next fit, from the end of the last allocation\n");
+    alloc_pt alloc3 = mem_new_alloc(pool, 10);
+    assert_ptr_equal((char *) alloc3, mem2 + 208);
+    alloc_pt alloc4 = mem_new_alloc(pool, 560);
+    assert_non_null(alloc4);
+    check_metadata(pool, BITMAP_FIT, 992, 870, 4, 1);
+
+    INFO("Wrapping around to the freed segment\n");
+    alloc_pt alloc5 = mem_new_alloc(pool, 10);
+    assert_ptr_equal(alloc5, alloc1);
+    check_metadata(pool, BITMAP_FIT, 992, 880, 5, 0);
+    assert_null(mem_new_alloc(pool, 0));
+
+    status = mem_del_alloc_addr(pool, alloc0->mem + 16);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+
+    INFO("Deallocating all, merging both neighbours last\n");
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc_addr(pool, mem2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    pool_segment_t exp2[3] =
+            {
+                    {128, 0},
+                    {32, 1},
+                    {832, 0},
+            };
+    check_pool(pool, exp2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+
+    pool_segment_t exp0[1] =
+            {
+                    {992, 0},
+            };
+    check_pool(pool, exp0);
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+/*******************************************/
+/***         13. THREAD CACHES           ***/
+/*******************************************/
+
+#ifdef MEM_POOL_THREADS
+static pool_pt tcache_pool;
+static alloc_pt tcache_allocs[16];
+static unsigned tcache_stage = 0; // 1 once the thread has allocated, 2 once the pool is closed
+static pthread_mutex_t tcache_stage_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tcache_stage_cond = PTHREAD_COND_INITIALIZER;
+
+static void tcache_set_stage(unsigned stage) {
+    pthread_mutex_lock(&tcache_stage_lock);
+    tcache_stage = stage;
+    pthread_cond_broadcast(&tcache_stage_cond);
+    pthread_mutex_unlock(&tcache_stage_lock);
+}
+
+static void tcache_wait_stage(unsigned stage) {
+    pthread_mutex_lock(&tcache_stage_lock);
+    while (tcache_stage < stage) {
+        pthread_cond_wait(&tcache_stage_cond, &tcache_stage_lock);
+    }
+    pthread_mutex_unlock(&tcache_stage_lock);
+}
+
+// takes a whole batch, which leaves the thread's cache for the pool
+// empty, and exits only once the pool is closed
+static void *tcache_hold(void *arg) {
+    (void) arg; /* unused */
+    for (unsigned i = 0; i < 16; i++) {
+        tcache_allocs[i] = mem_new_alloc(tcache_pool, 48);
+    }
+    tcache_set_stage(1);
+    tcache_wait_stage(2);
+    return NULL;
+}
+#endif
+
+static void test_pool_tcache(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+#ifdef MEM_POOL_THREADS
+    assert_int_equal(mem_pool_enable_tcache(pool), ALLOC_OK);
+
+    // a miss takes a batch of 16 blocks from the pool, one of them handed out
+    INFO("Allocating 40 bytes, rounded up to 48\n");
+    alloc_pt alloc0 = mem_new_alloc(pool, 40);
+    assert_non_null(alloc0);
+    assert_int_equal(alloc0->size, 48);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 16 * 48, 16, 1);
+
+    INFO("Freeing and allocating again from the thread's cache\n");
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 16 * 48, 16, 1);
+
+    INFO("Trying to free the cached block again...");
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc_addr(pool, alloc0->mem), ALLOC_NOT_FREED);
+    INFO(" failed.\n");
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 16 * 48, 16, 1);
+
+    alloc_pt alloc1 = mem_new_alloc(pool, 33);
+    assert_ptr_equal(alloc1, alloc0);
+
+    INFO("Trying to free a copy of the record, and another pool's record...");
+    alloc_t copy = *alloc1;
+    assert_int_equal(mem_del_alloc(pool, &copy), ALLOC_NOT_FREED);
+    pool_pt other = mem_pool_open(1000, FIRST_FIT);
+    assert_non_null(other);
+    alloc_pt foreign = mem_new_alloc(other, 48);
+    assert_non_null(foreign);
+    assert_int_equal(mem_del_alloc(pool, foreign), ALLOC_NOT_FREED);
+    INFO(" failed.\n");
+    assert_int_equal(mem_del_alloc(other, foreign), ALLOC_OK);
+    assert_int_equal(mem_pool_close(other), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 16 * 48, 16, 1);
+
+    alloc_pt alloc3 = mem_new_alloc(pool, 33);
+    assert_non_null(alloc3);
+    assert_ptr_not_equal(alloc3, alloc1);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    // other sizes go to the pool as before
+    alloc_pt alloc2 = mem_new_alloc(pool, 1000);
+    assert_non_null(alloc2);
+    assert_int_equal(alloc2->size, 1000);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    INFO("Flushing the cache back to the pool\n");
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    mem_tcache_flush();
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    unsigned long hits = 0, misses = 0;
+    mem_inspect_tcache(pool, &hits, &misses);
+    assert_int_equal(hits, 2);
+    assert_int_equal(misses, 1);
+
+    INFO("Closing a pool with an empty cache in another thread\n");
+    tcache_pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert_non_null(tcache_pool);
+    assert_int_equal(mem_pool_enable_tcache(tcache_pool), ALLOC_OK);
+    pthread_t thread;
+    assert_int_equal(pthread_create(&thread, NULL, tcache_hold, NULL), 0);
+    tcache_wait_stage(1);
+    for (unsigned i = 0; i < 16; i++) {
+        assert_non_null(tcache_allocs[i]);
+        assert_int_equal(mem_del_alloc(tcache_pool, tcache_allocs[i]), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_close(tcache_pool), ALLOC_OK);
+    // the thread's exit must not flush into the closed pool
+    tcache_set_stage(2);
+    assert_int_equal(pthread_join(thread, NULL), 0);
+
+    // closing flushes the closing thread's cache first
+    alloc0 = mem_new_alloc(pool, 16);
+    assert_non_null(alloc0);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+#else
+    INFO("Built without MEM_POOL_THREADS, no caches\n");
+    assert_int_equal(mem_pool_enable_tcache(pool), ALLOC_FAIL);
+#endif
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    // objects of a slab are not rounded, so the caches stay off
+    INFO("Trying to enable the caches of a slab pool...");
+    pool = mem_pool_open_slab(60, 10);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_enable_tcache(pool), ALLOC_FAIL);
+    INFO(" failed.\n");
+    alloc_pt alloc = mem_new_alloc(pool, 60);
+    assert_non_null(alloc);
+    assert_int_equal(alloc->size, 60);
+    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+/*******************************************/
+/***         14. REMOTE FREES            ***/
+/*******************************************/
+
+#ifdef MEM_POOL_THREADS
+static alloc_pt remote_alloc;
+static pool_pt remote_pool;
+
+static void *remote_free(void *arg) {
+    (void) arg; /* unused */
+    return (void *) (size_t) mem_del_alloc(remote_pool, remote_alloc);
+}
+#endif
+
+static void test_pool_remote_free(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+#ifdef MEM_POOL_THREADS
+    assert_int_equal(mem_pool_set_owner(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_set_owner(pool), ALLOC_CALLED_AGAIN);
+
+    INFO("Allocating 100 and 200 bytes, freeing 100 from another thread\n");
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    remote_pool = pool;
+    remote_alloc = alloc0;
+    pthread_t thread;
+    void *result = NULL;
+    assert_int_equal(pthread_create(&thread, NULL, remote_free, NULL), 0);
+    assert_int_equal(pthread_join(thread, &result), 0);
+    assert_int_equal((size_t) result, ALLOC_OK);
+
+    // queued, not yet freed (inspecting the pool would free it)
+    assert_int_equal(pool->alloc_size, 300);
+    assert_int_equal(pool->num_allocs, 2);
+
+    INFO("Trying to free the queued allocation again...");
+    assert_int_equal(pthread_create(&thread, NULL, remote_free, NULL), 0);
+    assert_int_equal(pthread_join(thread, &result), 0);
+    assert_int_equal((size_t) result, ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_NOT_FREED);
+    INFO(" failed.\n");
+
+    INFO("Trying to free a copy of an allocation record from another thread...");
+    alloc_t copy = *alloc1;
+    remote_alloc = &copy;
+    assert_int_equal(pthread_create(&thread, NULL, remote_free, NULL), 0);
+    assert_int_equal(pthread_join(thread, &result), 0);
+    assert_int_equal((size_t) result, ALLOC_NOT_FREED);
+    INFO(" failed.\n");
+
+    INFO("Trying to free another pool's allocation from another thread...");
+    pool_pt other = mem_pool_open(1000, FIRST_FIT);
+    assert_non_null(other);
+    remote_alloc = mem_new_alloc(other, 100);
+    assert_non_null(remote_alloc);
+    assert_int_equal(pthread_create(&thread, NULL, remote_free, NULL), 0);
+    assert_int_equal(pthread_join(thread, &result), 0);
+    assert_int_equal((size_t) result, ALLOC_NOT_FREED);
+    INFO(" failed.\n");
+    assert_int_equal(mem_del_alloc(other, remote_alloc), ALLOC_OK);
+    assert_int_equal(mem_pool_close(other), ALLOC_OK);
+
+    INFO("Allocating 50 bytes, freeing the queued allocation first\n");
+    alloc_pt alloc2 = mem_new_alloc(pool, 50);
+    assert_ptr_equal(alloc2->mem, pool->mem);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 250, 2, 2);
+
+    // the owner's own frees take the lock as before
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+#else
+    INFO("Built without MEM_POOL_THREADS, no owners\n");
+    assert_int_equal(mem_pool_set_owner(pool), ALLOC_FAIL);
+#endif
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    // with no nodes to mark queued blocks in, a slab keeps no queue
+    pool = mem_pool_open_slab(64, 10);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_owner(pool), ALLOC_FAIL);
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+/*******************************************/
+/***         15. SHARDED POOLS           ***/
+/*******************************************/
+
+static void test_pool_sharded(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating sharded pool of 4 shards of 1000 bytes\n");
+    sharded_pool_pt pool = mem_sharded_pool_open(1000, FIRST_FIT, 4);
+    assert_non_null(pool);
+    assert_int_equal(pool->num_shards, 4);
+
+    // which shard comes first depends on the CPU, so only the totals and
+    // the owning shards are checked
+    INFO("Allocating 600 bytes 4 times, one per shard\n");
+    alloc_pt allocs[4];
+    for (unsigned u = 0; u < 4; u++) {
+        allocs[u] = mem_sharded_new_alloc(pool, 600);
+        assert_non_null(allocs[u]);
+    }
+    assert_null(mem_sharded_new_alloc(pool, 600));
+    assert_null(mem_sharded_new_alloc(pool, 0));
+    for (unsigned u = 0; u < 4; u++) {
+        assert_int_equal(pool->shards[u]->num_allocs, 1);
+    }
+
+    pool_t totals;
+    mem_inspect_sharded_pool(pool, &totals);
+    assert_int_equal(totals.policy, FIRST_FIT);
+    assert_int_equal(totals.total_size, 4000);
+    assert_int_equal(totals.alloc_size, 2400);
+    assert_int_equal(totals.num_allocs, 4);
+    assert_int_equal(totals.num_gaps, 4);
+
+    status = mem_sharded_pool_close(pool);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+
+    INFO("Deallocating all, each to its own shard\n");
+    pool_pt other = mem_pool_open(1000, FIRST_FIT);
+    alloc_pt foreign = mem_new_alloc(other, 100);
+    assert_int_equal(mem_sharded_del_alloc(pool, foreign), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc(other, foreign), ALLOC_OK);
+    assert_int_equal(mem_pool_close(other), ALLOC_OK);
+    // all but the allocation in the last shard, which the first shards
+    // would close before
+    alloc_pt last = NULL;
+    for (unsigned u = 0; u < 4; u++) {
+        pool_pt shard = pool->shards[3];
+        if (allocs[u]->mem >= shard->mem && allocs[u]->mem < shard->mem + shard->total_size) {
+            last = allocs[u];
+            continue;
+        }
+        assert_int_equal(mem_sharded_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    assert_non_null(last);
+
+    INFO("Trying to close sharded pool with one shard in use...");
+    status = mem_sharded_pool_close(pool);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    INFO(" failed.\n");
+    mem_inspect_sharded_pool(pool, &totals);
+    assert_int_equal(totals.num_allocs, 1);
+    alloc_pt again = mem_sharded_new_alloc(pool, 600);
+    assert_non_null(again);
+    assert_int_equal(mem_sharded_del_alloc(pool, again), ALLOC_OK);
+
+    assert_int_equal(mem_sharded_del_alloc(pool, last), ALLOC_OK);
+    mem_inspect_sharded_pool(pool, &totals);
+    assert_int_equal(totals.alloc_size, 0);
+    assert_int_equal(totals.num_allocs, 0);
+
+    INFO("Closing sharded pool\n");
+    status = mem_sharded_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+/*******************************************/
+/***         16. LOCK-FREE SLABS         ***/
+/*******************************************/
+
+#ifdef MEM_POOL_THREADS
+static void *lockfree_churn(void *arg) {
+    pool_pt pool = (pool_pt) arg;
+    for (unsigned u = 0; u < 10000; u++) {
+        alloc_pt alloc = mem_new_alloc(pool, 8);
+        if (alloc != NULL && mem_del_alloc(pool, alloc) != ALLOC_OK) {
+            return arg;
+        }
+    }
+    return NULL;
+}
+#endif
+
+static void test_pool_lockfree(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    assert_null(mem_pool_open(POOL_SIZE, LOCKFREE_SLAB_FIT));
+
+    INFO("Allocating lock-free slab pool of 100 x 60 bytes\n");
+    pool_pt pool = mem_pool_open_lockfree(60, 100);
+    assert_non_null(pool);
+    check_metadata(pool, LOCKFREE_SLAB_FIT, 6400, 0, 0, 1);
+
+    INFO("Allocating 3 objects\n");
+    alloc_pt alloc0 = mem_new_alloc(pool, 60);
+    alloc_pt alloc1 = mem_new_alloc(pool, 60);
+    alloc_pt alloc2 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_int_equal(alloc1->mem - alloc0->mem, 64);
+    assert_null(mem_new_alloc(pool, 61));
+
+    INFO("Deallocating the middle object\n");
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc_addr(pool, alloc0->mem + 8), ALLOC_NOT_FREED);
+
+    // the gaps are only counted by inspecting the pool
+    pool_segment_t exp1[4] =
+            {
+                    {64, 1},
+                    {64, 0},
+                    {64, 1},
+                    {6400 - 192, 0},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, LOCKFREE_SLAB_FIT, 6400, 110, 2, 2);
+
+    INFO("Reallocating the freed object\n");
+    alloc_pt alloc3 = mem_new_alloc(pool, 60);
+    assert_ptr_equal(alloc3, alloc1);
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc_addr(pool, alloc2->mem), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+#ifdef MEM_POOL_THREADS
+    INFO("Allocating and deallocating from 4 threads at once\n");
+    pthread_t threads[4];
+    for (unsigned t = 0; t < 4; t++) {
+        assert_int_equal(pthread_create(&threads[t], NULL, lockfree_churn, pool), 0);
+    }
+    for (unsigned t = 0; t < 4; t++) {
+        void *result = pool;
+        assert_int_equal(pthread_join(threads[t], &result), 0);
+        assert_null(result);
+    }
+#endif
+
+    pool_segment_t exp0[1] =
+            {
+                    {6400, 0},
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, LOCKFREE_SLAB_FIT, 6400, 0, 0, 1);
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+/*******************************************/
+/***            17. CONTEXTS             ***/
+/*******************************************/
+
+static void test_pool_contexts(void **state) {
+    (void) state; /* unused */
+
+    INFO("Creating 2 contexts, without mem_init\n");
+    mem_ctx_pt ctx0 = mem_ctx_create();
+    mem_ctx_pt ctx1 = mem_ctx_create();
+    assert_non_null(ctx0);
+    assert_non_null(ctx1);
+    assert_null(mem_pool_open(POOL_SIZE, FIRST_FIT));
+
+    pool_pt pool0 = mem_ctx_pool_open(ctx0, POOL_SIZE, FIRST_FIT);
+    pool_pt pool1 = mem_ctx_pool_open(ctx1, 1000, BEST_FIT);
+    pool_pt slab1 = mem_ctx_pool_open_slab(ctx1, 60, 100);
+    assert_non_null(pool0);
+    assert_non_null(pool1);
+    assert_non_null(slab1);
+
+    // the pool calls are the same in every context
+    alloc_pt alloc0 = mem_new_alloc(pool0, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool1, 100);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    check_metadata(pool1, BEST_FIT, 1000, 100, 1, 1);
+    assert_int_equal(mem_del_alloc(pool1, alloc1), ALLOC_OK);
+
+    INFO("Destroying one context, closing its pools\n");
+    assert_int_equal(mem_ctx_destroy(ctx1), ALLOC_OK);
+
+    // the default context is apart from both
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+
+    INFO("Destroying a context with a pool still holding an allocation\n");
+    assert_int_equal(mem_ctx_destroy(ctx0), ALLOC_OK);
+
+    // the pool outlives its context, and closes once empty
+    check_metadata(pool0, FIRST_FIT, POOL_SIZE, 100, 1, 1);
+    assert_int_equal(mem_del_alloc(pool0, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool0), ALLOC_OK);
+}
+
+/*******************************************/
+/***         18. STRESS TEST             ***/
+/*******************************************/
+
+void test_pool_stresstest(void **state) {
+    (void) state; /* unused */
+
+    const unsigned num_pools = 200;
+    const unsigned num_allocations = 1000;
+    const unsigned min_alloc_size = 10;
+    const unsigned pool_size =
+            (num_allocations / 2) *
+            (2 * min_alloc_size + (num_allocations - 1) * min_alloc_size);
+    assert_int_equal(pool_size, 5005000);
+
+
+    pool_pt pools[num_pools];
+    char *allocations[num_pools][num_allocations];
+
+    /*
+     * NOTE: The test holds on to the allocation addresses in
+     * the pools rather than the allocation records, through
+     * mem_new_alloc_addr and mem_del_alloc_addr.
+     */
+
+    /*
+     * Testing dynamic reallocation of pool structures:
+     *
+     * 1. 200 pools of 5005000 each (many pools)
+     * 2. In each pool 1000 allocations of different sizes (many allocations)
+     * 3. In each pool 500 deallocations (many gaps)
+     */
+
+    // initialize store
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // allocate pools
+    for (unsigned pix=0; pix < num_pools; ++pix) {
+        // open pool
+        pools[pix] =
+                mem_pool_open(pool_size, (pix % 2) ? FIRST_FIT : BEST_FIT);
+        assert_non_null(pools[pix]);
+        // allocate pool
+        unsigned allocated = 0;
+        for (unsigned aix=0; aix < num_allocations; ++aix) {
+            allocations[pix][aix] =
+                    mem_new_alloc_addr(pools[pix], (aix + 1) * min_alloc_size);
+            allocated += (aix + 1) * min_alloc_size;
+            if (!allocations[pix][aix]) {
+                INFO("ASSERT WILL FAIL at pix = %u, aix = %u, allocated = %u\n", pix, aix, allocated);
+            }
+            assert_non_null(allocations[pix][aix]);
+        }
+        // delete every other allocation
+        for (unsigned aix=0; aix < num_allocations; ++aix) {
+            if (aix % 2) {
+                assert_int_equal(
+                        mem_del_alloc_addr(pools[pix], allocations[pix][aix]),
+                        ALLOC_OK);
+                // a second delete of the same address is refused
+                assert_int_equal(
+                        mem_del_alloc_addr(pools[pix], allocations[pix][aix]),
+                        ALLOC_NOT_FREED);
+                allocations[pix][aix] = NULL;
+            }
+        }
+    }
+
+    // delete pools
+    for (unsigned pix=0; pix < num_pools; ++pix) {
+        // delete pool's allocations
+        for (unsigned aix=0; aix < num_allocations; ++aix) {
+            if (allocations[pix][aix]) {
+                // delete allocation
+                assert_int_equal(
+                    mem_del_alloc_addr(pools[pix], allocations[pix][aix]),
+                    ALLOC_OK);
+            }
+        }
+        // close pool
+        assert_int_equal(mem_pool_close(pools[pix]), ALLOC_OK);
+    }
+
+    // free store
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+/*******************************************/
+/***        19. DRIVER ROUTINE           ***/
+/*******************************************/
+
+int run_test_suite() {
+    const struct CMUnitTest tests[] = {
+            cmocka_unit_test(test_pool_store_smoketest),
+            cmocka_unit_test(test_pool_smoketest),
+            cmocka_unit_test(test_pool_store_reuse),
+            cmocka_unit_test(test_pool_close_after_free),
+
+            cmocka_unit_test(test_pool_nonempty),
+            cmocka_unit_test(test_pool_addr_zero_size),
+
+            cmocka_unit_test_setup_teardown(test_pool_ff_metadata, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_bf_metadata, pool_bf_setup, pool_bf_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario00, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario01, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario02, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario03, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario04, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario05, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario06, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario07, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario08, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario09, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario10, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario25, pool_ff_setup, pool_ff_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario11, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario12, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario13, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario14, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario15, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario16, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario17, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario18, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario19, pool_bf_setup, pool_bf_teardown),
 
-            // do not uncomment until the project is changed to return the allocation address
-//            cmocka_unit_test(test_pool_stresstest),
+            cmocka_unit_test_setup_teardown(test_pool_scenario20, pool_sf_setup, pool_sf_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario21, pool_tf_setup, pool_tf_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario22, pool_buddy_setup, pool_buddy_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario23, pool_nf_setup, pool_nf_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario24, pool_wf_setup, pool_wf_teardown),
+
+            cmocka_unit_test(test_pool_slab),
+
+            cmocka_unit_test(test_pool_tagged),
+
+            cmocka_unit_test(test_pool_bitmap),
+
+            cmocka_unit_test(test_pool_tcache),
+            cmocka_unit_test(test_pool_remote_free),
+            cmocka_unit_test(test_pool_sharded),
+            cmocka_unit_test(test_pool_lockfree),
+            cmocka_unit_test(test_pool_contexts),
+
+            cmocka_unit_test(test_pool_stresstest),
     };
 
     return cmocka_run_group_tests_name("pool_test_suite", tests, NULL, NULL);
 }
 
 /* future editions */
-// TODO stress test: many pools, many allocations, many gaps (requires project refactoring, see NOTE in test body)
 // TODO test memory leaks: any way to do it w/o having to rewrite the source file?
 // TODO fix the final PASSED line of std::cerr output to the end of the file (?)